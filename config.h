@@ -58,6 +58,9 @@
 /* Define to 1 if you have the <libutil.h> header file. */
 /* #undef HAVE_LIBUTIL_H */
 
+/* Define to 1 if you have the <linux/io_uring.h> header file. */
+/* #undef HAVE_LINUX_IO_URING_H */
+
 /* Define to 1 if you have the <linux/netfilter_ipv4.h> header file. */
 #define HAVE_LINUX_NETFILTER_IPV4_H 1
 
@@ -139,6 +142,9 @@
 /* Define to 1 if you have the <systemd/sd-daemon.h> header file. */
 /* #undef HAVE_SYSTEMD_SD_DAEMON_H */
 
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+/* #undef HAVE_SYS_EPOLL_H */
+
 /* Define to 1 if you have the <sys/filio.h> header file. */
 /* #undef HAVE_SYS_FILIO_H */
 
@@ -251,6 +257,9 @@
 /* Define to 1 if you have the ANSI C header files. */
 #define STDC_HEADERS 1
 
+/* Define to 1 to select EPOLL mode */
+/* #undef USE_EPOLL */
+
 /* Define to 1 to enable OpenSSL FIPS support */
 /* #undef USE_FIPS */
 
@@ -48,13 +48,43 @@
 #define SHUT_RDWR 2
 #endif
 
+typedef struct buffer_pool_struct {
+    struct buffer_pool_struct *next;
+    int size; /* size of pooled allocations */
+    void *idle; /* linked list of idle allocations */
+    int count; /* number of idle allocations */
+} BUFFER_POOL;
+
+static BUFFER_POOL *buffer_pools=NULL;
+
 NOEXPORT void client_try(CLI *);
 NOEXPORT void client_run(CLI *);
 NOEXPORT void init_local(CLI *);
 NOEXPORT void init_remote(CLI *);
 NOEXPORT void init_ssl(CLI *);
+#ifdef USE_ASYNC_JOBS
+NOEXPORT void async_poll(CLI *);
+#endif
 NOEXPORT void new_chain(CLI *);
+NOEXPORT char *session_key(CLI *);
 NOEXPORT void transfer(CLI *);
+NOEXPORT BUFFER_POOL *buffer_pool(int);
+NOEXPORT void buffers_get(CLI *);
+NOEXPORT int buffers_put(CLI *);
+NOEXPORT void idle_release(CLI *);
+NOEXPORT int ssl_buffers_free(SSL *);
+NOEXPORT int ring_tail(int, int, int);
+NOEXPORT int ring_space(int, int, int);
+NOEXPORT int ring_data(int, int, int);
+NOEXPORT int ring_top(int, int, int, int);
+NOEXPORT void ring_consume(int, int *, int *, int);
+NOEXPORT int ring_readsocket(int, char *, int, int, int);
+NOEXPORT int ring_writesocket(int, char *, int, int, int, int);
+#ifndef USE_WIN32
+NOEXPORT int coalesce_left(CLI *, struct timeval *);
+#endif
+NOEXPORT int record_size(CLI *);
+NOEXPORT void record_sent(CLI *, int);
 NOEXPORT int parse_socket_error(CLI *, const char *);
 
 NOEXPORT void print_cipher(CLI *);
@@ -94,7 +124,7 @@ void *client_thread(void *arg) {
 #if defined(USE_WIN32) && !defined(_WIN32_WCE)
     _endthread();
 #endif
-#ifdef USE_UCONTEXT
+#if defined(USE_UCONTEXT) || defined(USE_EPOLL)
     s_poll_wait(NULL, 0, 0); /* wait on poll() */
 #endif
     return NULL;
@@ -157,6 +187,9 @@ NOEXPORT void client_run(CLI *c) {
         "Connection %s: %d byte(s) sent to SSL, %d byte(s) sent to socket",
          rst ? "reset" : "closed", c->ssl_bytes, c->sock_bytes);
 
+        /* release c->fds slots before their descriptors are closed */
+    s_poll_init(c->fds);
+
         /* cleanup temporary (e.g. IDENT) socket */
     if(c->fd>=0)
         closesocket(c->fd);
@@ -211,6 +244,7 @@ NOEXPORT void client_run(CLI *c) {
 #endif
 
         /* free remaining memory structures */
+    buffers_put(c);
     if(c->connect_addr.addr)
         str_free(c->connect_addr.addr);
     s_poll_free(c->fds);
@@ -331,7 +365,8 @@ NOEXPORT void init_remote(CLI *c) {
 
 NOEXPORT void init_ssl(CLI *c) {
     int i, err;
-    SSL_SESSION *old_session;
+    char *key=NULL;
+    SSL_SESSION *session;
     int unsafe_openssl;
 
     c->ssl=SSL_new(c->opt->ctx);
@@ -350,11 +385,8 @@ NOEXPORT void init_ssl(CLI *c) {
             }
         }
 #endif
-        if(c->opt->session) {
-            enter_critical_section(CRIT_SESSION);
-            SSL_set_session(c->ssl, c->opt->session);
-            leave_critical_section(CRIT_SESSION);
-        }
+        key=session_key(c);
+        session_cache_get(c->opt, key, c->ssl);
         SSL_set_fd(c->ssl, c->remote_fd.fd);
         SSL_set_connect_state(c->ssl);
     } else {
@@ -422,6 +454,12 @@ NOEXPORT void init_ssl(CLI *c) {
             }
             continue; /* ok -> retry */
         }
+#ifdef USE_ASYNC_JOBS
+        if(err==SSL_ERROR_WANT_ASYNC) { /* private key operation queued */
+            async_poll(c);
+            continue; /* ok -> retry */
+        }
+#endif
         if(err==SSL_ERROR_SYSCALL) {
             switch(get_last_socket_error()) {
             case S_EINTR:
@@ -445,18 +483,46 @@ NOEXPORT void init_ssl(CLI *c) {
         new_chain(c);
         if(c->opt->option.client) {
             s_log(LOG_INFO, "SSL connected: new session negotiated");
-            enter_critical_section(CRIT_SESSION);
-            old_session=c->opt->session;
-            c->opt->session=SSL_get1_session(c->ssl); /* store it */
-            if(old_session)
-                SSL_SESSION_free(old_session); /* release the old one */
-            leave_critical_section(CRIT_SESSION);
+            session=SSL_get1_session(c->ssl);
+            if(session)
+                session_cache_put(c->opt, key, session);
         } else
             s_log(LOG_INFO, "SSL accepted: new session negotiated");
         print_cipher(c);
     }
+    str_free(key);
 }
 
+#ifdef USE_ASYNC_JOBS
+/* wait for the key worker without blocking other connections */
+NOEXPORT void async_poll(CLI *c) {
+    OSSL_ASYNC_FD *fds;
+    size_t i, num=0;
+
+    if(!SSL_get_all_async_fds(c->ssl, NULL, &num) || !num) {
+        sslerror("SSL_get_all_async_fds");
+        longjmp(c->err, 1);
+    }
+    fds=str_alloc(num*sizeof(OSSL_ASYNC_FD));
+    SSL_get_all_async_fds(c->ssl, fds, &num);
+    s_poll_init(c->fds);
+    for(i=0; i<num; i++)
+        s_poll_add(c->fds, fds[i], 1, 0);
+    str_free(fds);
+    switch(s_poll_wait(c->fds, c->opt->timeout_busy, 0)) {
+    case -1:
+        sockerror("async_poll: s_poll_wait");
+        longjmp(c->err, 1);
+    case 0:
+        s_log(LOG_INFO, "async_poll: s_poll_wait:"
+            " TIMEOUTbusy exceeded: sending reset");
+        longjmp(c->err, 1);
+    default:
+        break; /* OK */
+    }
+}
+#endif /* USE_ASYNC_JOBS */
+
 NOEXPORT void new_chain(CLI *c) {
     BIO *bio;
     int i, len;
@@ -503,10 +569,36 @@ NOEXPORT void new_chain(CLI *c) {
     s_log(LOG_DEBUG, "Peer certificate was cached (%d bytes)", len);
 }
 
+/****************************** client session cache */
+
+/* sessions are cached separately for each destination and SNI, so
+ * connections to several servers (e.g. with failover) do not overwrite
+ * each other's sessions */
+
+NOEXPORT char *session_key(CLI *c) {
+    SOCKADDR_UNION addr;
+    socklen_t len=sizeof addr;
+    char *address, *key;
+
+    if(getpeername(c->remote_fd.fd, &addr.sa, &len))
+        address=str_dup("unknown address");
+    else
+        address=s_ntop(&addr, len);
+#ifndef OPENSSL_NO_TLSEXT
+    key=str_printf("%s %s", address, c->opt->sni ? c->opt->sni : "");
+#else
+    key=str_printf("%s", address);
+#endif
+    str_free(address);
+    return key;
+}
+
 /****************************** transfer data */
 NOEXPORT void transfer(CLI *c) {
     int watchdog=0; /* a counter to detect an infinite loop */
-    int num, err;
+    int num, err, tail, batch;
+    int timeout, release_wait, waited=0; /* seconds waited before release */
+    int write_len=0; /* length of the SSL_write() to be retried */
     /* logical channels (not file descriptors!) open for read or write */
     int sock_open_rd=1, sock_open_wr=1;
     /* awaited conditions on SSL file descriptors */
@@ -515,45 +607,84 @@ NOEXPORT void transfer(CLI *c) {
     int write_wants_read=0, write_wants_write=0;
     /* actual conditions on file descriptors */
     int sock_can_rd, sock_can_wr, ssl_can_rd, ssl_can_wr;
+    /* c->fds slots of file descriptors (shared by equal descriptors) */
+    int sock_rd_slot, sock_wr_slot, ssl_rd_slot, ssl_wr_slot;
+    int hold_ms=0; /* time left to wait for more data to coalesce */
+#ifndef USE_WIN32
+    struct timeval sock_since; /* arrival of the oldest unsent socket data */
+
+    gettimeofday(&sock_since, NULL);
+#endif
 
     c->sock_ptr=c->ssl_ptr=0;
+    c->sock_head=c->ssl_head=0;
+    c->buff_size=c->opt->buffer_size;
+    c->sock_buff=c->ssl_buff=NULL; /* allocated when data arrives */
+
+    /* register file descriptors once, only interest changes in the loop */
+    s_poll_init(c->fds);
+    sock_rd_slot=s_poll_slot(c->fds, c->sock_rfd->fd);
+    sock_wr_slot=s_poll_slot(c->fds, c->sock_wfd->fd);
+    ssl_rd_slot=s_poll_slot(c->fds, c->ssl_rfd->fd);
+    ssl_wr_slot=s_poll_slot(c->fds, c->ssl_wfd->fd);
 
     do { /* main loop of client data transfer */
         /****************************** initialize *_wants_* */
         read_wants_read|=!(SSL_get_shutdown(c->ssl)&SSL_RECEIVED_SHUTDOWN)
-            && c->ssl_ptr<BUFFSIZE && !read_wants_write;
+            && c->ssl_ptr<c->buff_size && !read_wants_write;
+#ifndef USE_WIN32
+        hold_ms=sock_open_rd && c->sock_ptr ? coalesce_left(c, &sock_since) : 0;
+#endif
         write_wants_write|=!(SSL_get_shutdown(c->ssl)&SSL_SENT_SHUTDOWN)
-            && c->sock_ptr && !write_wants_read;
+            && c->sock_ptr && !write_wants_read && !hold_ms;
+
+        /****************************** release drained buffers */
+        if(!c->sock_ptr && !c->ssl_ptr && !c->opt->buffer_release)
+            buffers_put(c);
 
         /****************************** setup c->fds structure */
-        s_poll_init(c->fds); /* initialize the structure */
+        s_poll_reset(c->fds); /* clear the previous interest */
         /* for plain socket open data strem = open file descriptor */
         /* make sure to add each open socket to receive exceptions! */
         if(sock_open_rd) /* only poll if the read file descriptor is open */
-            s_poll_add(c->fds, c->sock_rfd->fd, c->sock_ptr<BUFFSIZE, 0);
+            s_poll_want(c->fds, sock_rd_slot, c->sock_ptr<c->buff_size, 0);
         if(sock_open_wr) /* only poll if the write file descriptor is open */
-            s_poll_add(c->fds, c->sock_wfd->fd, 0, c->ssl_ptr);
+            s_poll_want(c->fds, sock_wr_slot, 0, c->ssl_ptr);
         /* poll SSL file descriptors unless SSL shutdown was completed */
         if(SSL_get_shutdown(c->ssl)!=
                 (SSL_SENT_SHUTDOWN|SSL_RECEIVED_SHUTDOWN)) {
-            s_poll_add(c->fds, c->ssl_rfd->fd,
+            s_poll_want(c->fds, ssl_rd_slot,
                 read_wants_read || write_wants_read || shutdown_wants_read, 0);
-            s_poll_add(c->fds, c->ssl_wfd->fd, 0,
+            s_poll_want(c->fds, ssl_wr_slot, 0,
                 read_wants_write || write_wants_write || shutdown_wants_write);
         }
 
         /****************************** wait for an event */
-        err=s_poll_wait(c->fds,
-            (sock_open_rd && /* both peers open */
+        timeout=(sock_open_rd && /* both peers open */
                 !(SSL_get_shutdown(c->ssl)&SSL_RECEIVED_SHUTDOWN)) ||
             c->ssl_ptr /* data buffered to write to socket */ ||
             c->sock_ptr /* data buffered to write to SSL */ ?
-            c->opt->timeout_idle : c->opt->timeout_close, 0);
+            c->opt->timeout_idle : c->opt->timeout_close;
+        release_wait=c->opt->buffer_release && !waited &&
+            !c->sock_ptr && !c->ssl_ptr && c->opt->buffer_release<timeout;
+        if(hold_ms) /* wait for more data to fill an SSL record */
+            err=s_poll_wait(c->fds, 0, hold_ms);
+        else if(release_wait) /* wait for the connection to become idle */
+            err=s_poll_wait(c->fds, c->opt->buffer_release, 0);
+        else
+            err=s_poll_wait(c->fds, timeout>waited ? timeout-waited : 0, 0);
         switch(err) {
         case -1:
             sockerror("transfer: s_poll_wait");
             longjmp(c->err, 1);
         case 0: /* timeout */
+            if(hold_ms) /* coalescing delay expired: send the data */
+                continue;
+            if(release_wait) { /* shrink the idle connection */
+                idle_release(c);
+                waited=c->opt->buffer_release;
+                continue;
+            }
             if((sock_open_rd &&
                     !(SSL_get_shutdown(c->ssl)&SSL_RECEIVED_SHUTDOWN)) ||
                     c->ssl_ptr || c->sock_ptr) {
@@ -566,30 +697,31 @@ NOEXPORT void transfer(CLI *c) {
                 return; /* OK */
             }
         }
+        waited=0; /* not idle anymore */
 
         /****************************** check for errors on sockets */
-        err=s_poll_error(c->fds, c->sock_rfd->fd);
+        err=s_poll_slot_error(c->fds, sock_rd_slot);
         if(err && err!=S_EWOULDBLOCK && err!=S_EAGAIN) {
             s_log(LOG_NOTICE, "Read socket error: %s (%d)",
                 s_strerror(err), err);
             longjmp(c->err, 1);
         }
-        if(c->sock_wfd->fd!=c->sock_rfd->fd) { /* performance optimization */
-            err=s_poll_error(c->fds, c->sock_wfd->fd);
+        if(sock_wr_slot!=sock_rd_slot) { /* performance optimization */
+            err=s_poll_slot_error(c->fds, sock_wr_slot);
             if(err && err!=S_EWOULDBLOCK && err!=S_EAGAIN) {
                 s_log(LOG_NOTICE, "Write socket error: %s (%d)",
                     s_strerror(err), err);
                 longjmp(c->err, 1);
             }
         }
-        err=s_poll_error(c->fds, c->ssl_rfd->fd);
+        err=s_poll_slot_error(c->fds, ssl_rd_slot);
         if(err && err!=S_EWOULDBLOCK && err!=S_EAGAIN) {
             s_log(LOG_NOTICE, "SSL socket error: %s (%d)",
                 s_strerror(err), err);
             longjmp(c->err, 1);
         }
-        if(c->ssl_wfd->fd!=c->ssl_rfd->fd) { /* performance optimization */
-            err=s_poll_error(c->fds, c->ssl_wfd->fd);
+        if(ssl_wr_slot!=ssl_rd_slot) { /* performance optimization */
+            err=s_poll_slot_error(c->fds, ssl_wr_slot);
             if(err && err!=S_EWOULDBLOCK && err!=S_EAGAIN) {
                 s_log(LOG_NOTICE, "SSL socket error: %s (%d)",
                     s_strerror(err), err);
@@ -598,10 +730,10 @@ NOEXPORT void transfer(CLI *c) {
         }
 
         /****************************** retrieve results from c->fds */
-        sock_can_rd=s_poll_canread(c->fds, c->sock_rfd->fd);
-        sock_can_wr=s_poll_canwrite(c->fds, c->sock_wfd->fd);
-        ssl_can_rd=s_poll_canread(c->fds, c->ssl_rfd->fd);
-        ssl_can_wr=s_poll_canwrite(c->fds, c->ssl_wfd->fd);
+        sock_can_rd=s_poll_slot_canread(c->fds, sock_rd_slot);
+        sock_can_wr=s_poll_slot_canwrite(c->fds, sock_wr_slot);
+        ssl_can_rd=s_poll_slot_canread(c->fds, ssl_rd_slot);
+        ssl_can_wr=s_poll_slot_canwrite(c->fds, ssl_wr_slot);
 
         /****************************** checks for internal failures */
         /* please report any internal errors to stunnel-users mailing list */
@@ -655,8 +787,13 @@ NOEXPORT void transfer(CLI *c) {
 
         /****************************** read from socket */
         if(sock_open_rd && sock_can_rd) {
-            num=readsocket(c->sock_rfd->fd,
-                c->sock_buff+c->sock_ptr, BUFFSIZE-c->sock_ptr);
+            buffers_get(c);
+            num=ring_readsocket(c->sock_rfd->fd, c->sock_buff,
+                c->buff_size, c->sock_head, c->sock_ptr);
+#ifndef USE_WIN32
+            if(num>0 && !c->sock_ptr && c->opt->coalesce_delay)
+                gettimeofday(&sock_since, NULL);
+#endif
             switch(num) {
             case -1:
                 if(parse_socket_error(c, "readsocket"))
@@ -668,6 +805,8 @@ NOEXPORT void transfer(CLI *c) {
                 sock_open_rd=0;
                 break;
             default:
+                c->sock_top=ring_top(c->buff_size, c->sock_top,
+                    ring_tail(c->buff_size, c->sock_head, c->sock_ptr), num);
                 c->sock_ptr+=num;
                 watchdog=0; /* reset watchdog */
             }
@@ -675,7 +814,17 @@ NOEXPORT void transfer(CLI *c) {
 
         /****************************** write to socket */
         if(sock_open_wr && sock_can_wr) {
-            num=writesocket(c->sock_wfd->fd, c->ssl_buff, c->ssl_ptr);
+            /* let the kernel merge the data with the decrypted
+             * data that is already waiting in OpenSSL */
+            num=ring_writesocket(c->sock_wfd->fd, c->ssl_buff,
+                c->buff_size, c->ssl_head, c->ssl_ptr,
+#ifndef USE_WIN32
+                c->opt->coalesce_delay && c->sock_wfd->is_socket &&
+                SSL_pending(c->ssl)
+#else
+                0
+#endif
+                );
             switch(num) {
             case -1: /* error */
                 if(parse_socket_error(c, "writesocket"))
@@ -683,9 +832,7 @@ NOEXPORT void transfer(CLI *c) {
                 sock_open_rd=sock_open_wr=0;
                 break;
             default:
-                memmove(c->ssl_buff, c->ssl_buff+num, c->ssl_ptr-num);
-                c->ssl_ptr-=num;
-                memset(c->ssl_buff+c->ssl_ptr, 0, num); /* paranoia */
+                ring_consume(c->buff_size, &c->ssl_head, &c->ssl_ptr, num);
                 c->sock_bytes+=num;
                 watchdog=0; /* reset watchdog */
             }
@@ -694,23 +841,33 @@ NOEXPORT void transfer(CLI *c) {
         /****************************** update *_wants_* based on new *_ptr */
         /* this update is also required for SSL_pending() to be used */
         read_wants_read|=!(SSL_get_shutdown(c->ssl)&SSL_RECEIVED_SHUTDOWN)
-            && c->ssl_ptr<BUFFSIZE && !read_wants_write;
+            && c->ssl_ptr<c->buff_size && !read_wants_write;
+#ifndef USE_WIN32
+        hold_ms=sock_open_rd && c->sock_ptr ? coalesce_left(c, &sock_since) : 0;
+#endif
         write_wants_write|=!(SSL_get_shutdown(c->ssl)&SSL_SENT_SHUTDOWN)
-            && c->sock_ptr && !write_wants_read;
+            && c->sock_ptr && !write_wants_read && !hold_ms;
 
         /****************************** read from SSL */
-        if((read_wants_read && (ssl_can_rd || SSL_pending(c->ssl))) ||
+        /* drain the readable records until SSL_read() would block */
+        for(batch=0; batch<TRANSFER_BATCH &&
+                ((read_wants_read && (ssl_can_rd || SSL_pending(c->ssl))) ||
                 /* it may be possible to read some pending data after
                  * writesocket() above made some room in c->ssl_buff */
-                (read_wants_write && ssl_can_wr)) {
+                (read_wants_write && ssl_can_wr)); ++batch) {
             read_wants_read=0;
             read_wants_write=0;
-            num=SSL_read(c->ssl, c->ssl_buff+c->ssl_ptr, BUFFSIZE-c->ssl_ptr);
+            buffers_get(c);
+            tail=ring_tail(c->buff_size, c->ssl_head, c->ssl_ptr);
+            num=SSL_read(c->ssl, c->ssl_buff+tail,
+                ring_space(c->buff_size, c->ssl_head, c->ssl_ptr));
             switch(err=SSL_get_error(c->ssl, num)) {
             case SSL_ERROR_NONE:
                 if(num==0)
                     s_log(LOG_DEBUG, "SSL_read returned 0");
+                c->ssl_top=ring_top(c->buff_size, c->ssl_top, tail, num);
                 c->ssl_ptr+=num;
+                read_wants_read=c->ssl_ptr<c->buff_size; /* next record */
                 watchdog=0; /* reset watchdog */
                 break;
             case SSL_ERROR_WANT_WRITE:
@@ -751,22 +908,35 @@ NOEXPORT void transfer(CLI *c) {
                 s_log(LOG_ERR, "SSL_read/SSL_get_error returned %d", err);
                 longjmp(c->err, 1);
             }
+            if(err!=SSL_ERROR_NONE || !num)
+                break; /* would block, or needs to be handled by the loop */
         }
 
         /****************************** write to SSL */
-        if((write_wants_read && ssl_can_rd) ||
-                (write_wants_write && ssl_can_wr)) {
+        /* flush the buffered data until SSL_write() would block */
+        for(batch=0; batch<TRANSFER_BATCH &&
+                ((write_wants_read && ssl_can_rd) ||
+                (write_wants_write && ssl_can_wr)); ++batch) {
             write_wants_read=0;
             write_wants_write=0;
-            num=SSL_write(c->ssl, c->sock_buff, c->sock_ptr);
+            /* SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER is set in ctx.c */
+            buffers_get(c);
+            if(!write_len) { /* retries need the same length */
+                write_len=ring_data(c->buff_size, c->sock_head, c->sock_ptr);
+                num=record_size(c);
+                if(write_len>num)
+                    write_len=num;
+            }
+            num=SSL_write(c->ssl, c->sock_buff+c->sock_head, write_len);
             switch(err=SSL_get_error(c->ssl, num)) {
             case SSL_ERROR_NONE:
                 if(num==0)
                     s_log(LOG_DEBUG, "SSL_write returned 0");
-                memmove(c->sock_buff, c->sock_buff+num, c->sock_ptr-num);
-                c->sock_ptr-=num;
-                memset(c->sock_buff+c->sock_ptr, 0, num); /* paranoia */
+                write_len=0;
+                ring_consume(c->buff_size, &c->sock_head, &c->sock_ptr, num);
+                record_sent(c, num);
                 c->ssl_bytes+=num;
+                write_wants_write=c->sock_ptr>0; /* next record */
                 watchdog=0; /* reset watchdog */
                 break;
             case SSL_ERROR_WANT_WRITE: /* buffered data? */
@@ -807,14 +977,16 @@ NOEXPORT void transfer(CLI *c) {
                 s_log(LOG_ERR, "SSL_write/SSL_get_error returned %d", err);
                 longjmp(c->err, 1);
             }
+            if(err!=SSL_ERROR_NONE || !num)
+                break; /* would block, or needs to be handled by the loop */
         }
 
         /****************************** check for hangup conditions */
-        if(s_poll_rdhup(c->fds, c->sock_rfd->fd)) {
+        if(s_poll_slot_rdhup(c->fds, sock_rd_slot)) {
             s_log(LOG_INFO, "Read socket closed (hangup)");
             sock_open_rd=0;
         }
-        if(s_poll_hup(c->fds, c->sock_wfd->fd)) {
+        if(s_poll_slot_hup(c->fds, sock_wr_slot)) {
             if(c->ssl_ptr) {
                 s_log(LOG_ERR,
                     "Write socket closed (hangup) with %d unsent byte(s)",
@@ -824,8 +996,8 @@ NOEXPORT void transfer(CLI *c) {
             s_log(LOG_INFO, "Write socket closed (hangup)");
             sock_open_wr=0;
         }
-        if(s_poll_hup(c->fds, c->ssl_rfd->fd) ||
-                s_poll_hup(c->fds, c->ssl_wfd->fd)) {
+        if(s_poll_slot_hup(c->fds, ssl_rd_slot) ||
+                s_poll_slot_hup(c->fds, ssl_wr_slot)) {
             /* hangup -> buggy (e.g. Microsoft) peer:
              * SSL socket closed without close_notify alert */
             if(c->sock_ptr || write_wants_write) {
@@ -902,6 +1074,303 @@ NOEXPORT void transfer(CLI *c) {
         shutdown_wants_read || shutdown_wants_write);
 }
 
+/****************************** dynamic SSL record sizing */
+
+/* small records are sent at the start of a connection and after idle
+ * periods, so the peer can decrypt the first bytes without waiting for
+ * a full 16 KB record; full records are used for bulk transfers */
+
+/* maximum payload of the next SSL record */
+NOEXPORT int record_size(CLI *c) {
+    if(!c->opt->record_size_min)
+        return SSL3_RT_MAX_PLAIN_LENGTH; /* disabled */
+    if(time(NULL)-c->record_time>=c->opt->record_size_idle)
+        return c->opt->record_size_min; /* idle connection */
+    return c->record_bytes<c->opt->record_size_boost ?
+        c->opt->record_size_min : SSL3_RT_MAX_PLAIN_LENGTH;
+}
+
+NOEXPORT void record_sent(CLI *c, int num) {
+    time_t now;
+
+    if(!c->opt->record_size_min)
+        return; /* disabled */
+    now=time(NULL);
+    if(now-c->record_time>=c->opt->record_size_idle)
+        c->record_bytes=0; /* start over with small records */
+    c->record_bytes+=num;
+    c->record_time=now;
+}
+
+/****************************** I/O buffer pool */
+
+/* transfer() buffers are only allocated while data is buffered */
+/* idle buffers are shared by all clients with the same buffer size */
+
+/* must be called inside CRIT_BUFFERS */
+NOEXPORT BUFFER_POOL *buffer_pool(int size) {
+    BUFFER_POOL *pool;
+
+    for(pool=buffer_pools; pool; pool=pool->next)
+        if(pool->size==size)
+            return pool;
+    pool=str_alloc(sizeof(BUFFER_POOL));
+    str_detach(pool);
+    pool->size=size;
+    pool->next=buffer_pools;
+    buffer_pools=pool;
+    return pool;
+}
+
+NOEXPORT void buffers_get(CLI *c) {
+    BUFFER_POOL *pool;
+    void *buff;
+
+    if(c->sock_buff) /* already allocated */
+        return;
+    enter_critical_section(CRIT_BUFFERS);
+    pool=buffer_pool(2*c->buff_size);
+    buff=pool->idle;
+    if(buff) {
+        pool->idle=*(void **)buff;
+        pool->count--;
+    }
+    leave_critical_section(CRIT_BUFFERS);
+    if(!buff) {
+        buff=str_alloc(2*c->buff_size);
+        str_detach(buff);
+    }
+    c->sock_buff=buff;
+    c->ssl_buff=c->sock_buff+c->buff_size;
+    c->sock_top=c->ssl_top=0;
+}
+
+/* return the number of bytes freed instead of returned to the pool */
+NOEXPORT int buffers_put(CLI *c) {
+    BUFFER_POOL *pool;
+    void *buff=c->sock_buff;
+
+    if(!buff) /* not allocated */
+        return 0;
+    c->sock_buff=c->ssl_buff=NULL;
+    if(c->opt->option.wipe_buffers) { /* only the part that was used */
+        OPENSSL_cleanse(buff, c->sock_top);
+        OPENSSL_cleanse((char *)buff+c->buff_size, c->ssl_top);
+    }
+    enter_critical_section(CRIT_BUFFERS);
+    pool=buffer_pool(2*c->buff_size);
+    if(pool->count<BUFFER_POOL_SIZE) {
+        *(void **)buff=pool->idle;
+        pool->idle=buff;
+        pool->count++;
+        buff=NULL;
+    }
+    leave_critical_section(CRIT_BUFFERS);
+    if(!buff)
+        return 0;
+    str_free(buff); /* the pool is full */
+    return 2*c->buff_size;
+}
+
+/* release the buffers of a connection idle for bufferRelease seconds */
+/* both kinds of buffers are allocated again on demand */
+NOEXPORT void idle_release(CLI *c) {
+    int pooled=c->sock_buff ? 2*c->buff_size : 0, freed, ssl_freed=0;
+
+    freed=buffers_put(c);
+    pooled-=freed;
+    if(ssl_buffers_free(c->ssl))
+        ssl_freed=1;
+    else
+        s_log(LOG_DEBUG, "ssl_buffers_free: OpenSSL buffers still in use");
+    enter_critical_section(CRIT_BUFFERS);
+    c->opt->released++;
+    c->opt->pooled+=(unsigned long)pooled;
+    c->opt->freed+=(unsigned long)freed;
+    c->opt->ssl_released+=(unsigned long)ssl_freed;
+    leave_critical_section(CRIT_BUFFERS);
+    s_log(LOG_DEBUG, "Idle connection: %d byte(s) of buffers pooled,"
+        " %d byte(s) freed, OpenSSL buffers %s",
+        pooled, freed, ssl_freed ? "released" : "kept");
+}
+
+/* release OpenSSL record buffers, return 0 if they are still in use */
+NOEXPORT int ssl_buffers_free(SSL *ssl) {
+#if OPENSSL_VERSION_NUMBER>=0x10100000L
+    return SSL_free_buffers(ssl);
+#elif defined(SSL_MODE_RELEASE_BUFFERS)
+    /* the same conditions SSL_MODE_RELEASE_BUFFERS uses after each record */
+    if(!ssl->s3 || SSL_in_init(ssl) || ssl->rstate!=SSL_ST_READ_HEADER ||
+            ssl->s3->rbuf.left || ssl->s3->rrec.length || ssl->s3->wbuf.left)
+        return 0; /* SSLv2, a handshake, or unprocessed data */
+    if(!ssl->s3->rbuf.buf && !ssl->s3->wbuf.buf)
+        return 0; /* already released */
+    /* NULL buffers are allocated again by ssl3_read_n() and do_ssl3_write() */
+    if(ssl->s3->rbuf.buf) {
+        OPENSSL_free(ssl->s3->rbuf.buf);
+        ssl->s3->rbuf.buf=NULL;
+    }
+    if(ssl->s3->wbuf.buf) {
+        OPENSSL_free(ssl->s3->wbuf.buf);
+        ssl->s3->wbuf.buf=NULL;
+    }
+    return 1;
+#else
+    (void)ssl; /* skip warning about unused parameter */
+    return 0; /* OpenSSL 0.9.8 cannot allocate the buffers again */
+#endif
+}
+
+/* log the idle release counters of a service */
+void idle_release_stats(SERVICE_OPTIONS *opt) {
+    unsigned long released, pooled, freed, ssl_released;
+
+    enter_critical_section(CRIT_BUFFERS);
+    released=opt->released;
+    pooled=opt->pooled;
+    freed=opt->freed;
+    ssl_released=opt->ssl_released;
+    leave_critical_section(CRIT_BUFFERS);
+    opt->released_logged=released;
+    /* OpenSSL does not expose the size of its record buffers */
+    s_log(LOG_INFO, "Service [%s]: %lu idle release(s): %lu byte(s) pooled,"
+        " %lu byte(s) freed, %lu OpenSSL buffer release(s)",
+        opt->servname, released, pooled, freed, ssl_released);
+}
+
+/* log changed idle release counters, return seconds to the next check */
+int idle_release_timer(SERVICE_OPTIONS *opt) {
+    time_t now=time(NULL);
+    long left;
+
+    left=(long)(opt->released_checked+IDLE_STATS_INTERVAL-now);
+    if(left>0)
+        return (int)left;
+    opt->released_checked=now;
+    if(opt->released!=opt->released_logged) /* new releases */
+        idle_release_stats(opt);
+    return IDLE_STATS_INTERVAL;
+}
+
+/****************************** ring buffers */
+
+/* the first buffered byte is at *_head, *_ptr bytes are buffered */
+/* and the free space starts right after the buffered data */
+
+#if defined(HAVE_SYS_UIO_H) && !defined(USE_WIN32) && !defined(__INNOTEK_LIBC__)
+#define USE_IOVEC
+#endif
+
+/* index of the first free byte */
+NOEXPORT int ring_tail(int size, int head, int ptr) {
+    return (head+ptr)%size;
+}
+
+/* contiguous free space at the tail */
+NOEXPORT int ring_space(int size, int head, int ptr) {
+    int tail=ring_tail(size, head, ptr);
+
+    if(ptr==size) /* full */
+        return 0;
+    return tail<head ? head-tail : size-tail;
+}
+
+/* contiguous buffered data at the head */
+NOEXPORT int ring_data(int size, int head, int ptr) {
+    return head+ptr<=size ? ptr : size-head;
+}
+
+/* end of the used part of the buffer after num bytes were stored at tail */
+NOEXPORT int ring_top(int size, int top, int tail, int num) {
+    if(tail+num>size) /* wrapped around */
+        return size;
+    return tail+num>top ? tail+num : top;
+}
+
+NOEXPORT void ring_consume(int size, int *head, int *ptr, int num) {
+    *ptr-=num;
+    if(*ptr) /* advance the head */
+        *head=(*head+num)%size;
+    else /* empty: start over to maximize contiguous space */
+        *head=0;
+}
+
+/* read into the free space, wrapped around with readv() if needed */
+NOEXPORT int ring_readsocket(int fd, char *buff, int size, int head, int ptr) {
+#ifdef USE_IOVEC
+    struct iovec iov[2];
+    int tail=ring_tail(size, head, ptr);
+
+    iov[0].iov_base=buff+tail;
+    iov[0].iov_len=ring_space(size, head, ptr);
+    if(tail<head || !head) /* contiguous free space */
+        return readsocket(fd, iov[0].iov_base, iov[0].iov_len);
+    iov[1].iov_base=buff;
+    iov[1].iov_len=head;
+    return readv(fd, iov, 2);
+#else
+    return readsocket(fd, buff+ring_tail(size, head, ptr),
+        ring_space(size, head, ptr));
+#endif
+}
+
+/* write the buffered data, wrapped around with writev() if needed */
+/* more!=0 (sockets only) tells the kernel that more data will follow */
+NOEXPORT int ring_writesocket(int fd, char *buff, int size, int head, int ptr,
+        int more) {
+#ifdef USE_IOVEC
+    struct iovec iov[2];
+    int iovcnt=1;
+#ifdef MSG_MORE
+    struct msghdr msg;
+#endif
+
+    iov[0].iov_base=buff+head;
+    iov[0].iov_len=ring_data(size, head, ptr);
+    if(head+ptr>size) { /* wrapped data */
+        iov[1].iov_base=buff;
+        iov[1].iov_len=head+ptr-size;
+        iovcnt=2;
+    }
+#ifdef MSG_MORE
+    if(more) {
+        memset(&msg, 0, sizeof msg);
+        msg.msg_iov=iov;
+        msg.msg_iovlen=iovcnt;
+        return sendmsg(fd, &msg, MSG_MORE);
+    }
+#else
+    (void)more; /* skip warning about unused parameter */
+#endif
+    if(iovcnt==1) /* contiguous data */
+        return writesocket(fd, iov[0].iov_base, iov[0].iov_len);
+    return writev(fd, iov, 2);
+#else
+    (void)more; /* skip warning about unused parameter */
+    return writesocket(fd, buff+head, ring_data(size, head, ptr));
+#endif
+}
+
+#ifndef USE_WIN32
+
+/* milliseconds (rounded up) to wait for more socket data before SSL_write()
+ * to fill a full-size SSL record, or 0 to write the buffered data now */
+NOEXPORT int coalesce_left(CLI *c, struct timeval *since) {
+    struct timeval now;
+    long usec;
+
+    if(!c->opt->coalesce_delay ||
+            c->sock_ptr>=record_size(c) || c->sock_ptr>=c->buff_size)
+        return 0; /* disabled or a full record is available */
+    gettimeofday(&now, NULL);
+    usec=(now.tv_sec-since->tv_sec)*1000000L+(now.tv_usec-since->tv_usec);
+    if(usec<0 || usec>=c->opt->coalesce_delay)
+        return 0; /* expired, or the clock was changed */
+    return (int)((c->opt->coalesce_delay-usec+999)/1000);
+}
+
+#endif /* !USE_WIN32 */
+
     /* returns 0 on close and 1 on non-critical errors */
 NOEXPORT int parse_socket_error(CLI *c, const char *text) {
     switch(get_last_socket_error()) {
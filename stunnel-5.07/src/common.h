@@ -52,6 +52,30 @@
 /* I/O buffer size: 18432 (0x4800) is the maximum size of SSL record payload */
 #define BUFFSIZE 18432
 
+/* maximum number of idle I/O buffers kept for reuse (per buffer size) */
+#define BUFFER_POOL_SIZE 256
+
+/* interval (in seconds) of logging changed idle buffer release counters */
+#define IDLE_STATS_INTERVAL 300
+
+/* maximum number of SSL_read() or SSL_write() calls per transfer() wakeup */
+#define TRANSFER_BATCH 16
+
+/* maximum number of idle sessiond client sockets kept per service */
+#define SESSIOND_SOCKETS 16
+
+/* number of independently locked parts of the client session cache */
+#define SESSION_STRIPES 16
+
+/* maximum number of OCSP responses cached per service */
+#define OCSP_CACHE_SIZE 1024
+
+/* seconds to cache OCSP responses without nextUpdate */
+#define OCSP_CACHE_TIMEOUT 300
+
+/* seconds to wait before retrying a failed OCSP refresh */
+#define OCSP_CACHE_RETRY 60
+
 /* how many bytes of random input to read from files for PRNG */
 /* OpenSSL likes at least 128 bits, so 64 bytes seems plenty. */
 #define RANDOM_BYTES 64
@@ -152,7 +176,18 @@ typedef int socklen_t;
 #include <ucontext.h>
 #endif
 
-#ifdef USE_PTHREAD
+#ifdef USE_EPOLL
+#include <ucontext.h>
+#include <sys/epoll.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#define USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif /* HAVE_LINUX_IO_URING_H */
+#endif
+
+#if defined(USE_PTHREAD) || defined(USE_EPOLL)
 #ifndef THREADS
 #define THREADS
 #endif
@@ -317,6 +352,14 @@ typedef unsigned long u32;
 #endif /* HAVE_SYS_POLL_H */
 #endif /* HAVE_POLL_H */
 #endif /* HAVE_POLL && !BROKEN_POLL */
+#if defined(USE_EPOLL) && !defined(USE_POLL)
+#error EPOLL threading model requires poll()
+#endif /* USE_EPOLL && !USE_POLL */
+#if defined(USE_UCONTEXT) && defined(USE_POLL) && defined(HAVE_SYS_EPOLL_H)
+/* schedule UCONTEXT threads with epoll instead of scanning all contexts */
+#define USE_UCONTEXT_EPOLL
+#include <sys/epoll.h>
+#endif /* USE_UCONTEXT && USE_POLL && HAVE_SYS_EPOLL_H */
 
 #ifdef HAVE_SYS_FILIO_H
 #include <sys/filio.h>   /* for FIONBIO */
@@ -331,6 +374,7 @@ typedef unsigned long u32;
 
 #ifdef HAVE_SYS_UIO_H
 #include <sys/uio.h>    /* struct iovec */
+#include <sys/mman.h>   /* mmap */
 #endif /* HAVE_SYS_UIO_H */
 
 #include <netinet/in.h>  /* struct sockaddr_in */
@@ -384,6 +428,10 @@ extern char *sys_errlist[];
 /* kernel headers without IP_TRANSPARENT definition */
 #define IP_TRANSPARENT 19
 #endif /* IP_TRANSPARENT */
+#ifndef SO_REUSEPORT
+/* kernel headers without SO_REUSEPORT definition */
+#define SO_REUSEPORT 15
+#endif /* SO_REUSEPORT */
 #ifdef HAVE_LINUX_NETFILTER_IPV4_H
 #include <limits.h>
 #include <linux/types.h>
@@ -400,10 +448,11 @@ extern char *sys_errlist[];
 
 #define OPENSSL_THREAD_DEFINES
 #include <openssl/opensslconf.h>
-#if defined(USE_PTHREAD) && !(defined(OPENSSL_THREADS) || \
+#if (defined(USE_PTHREAD) || defined(USE_EPOLL)) && \
+    !(defined(OPENSSL_THREADS) || \
     (OPENSSL_VERSION_NUMBER<0x0090700fL && defined(THREADS)))
 #error OpenSSL library compiled without thread support
-#endif /* !OPENSSL_THREADS && USE_PTHREAD */
+#endif /* !OPENSSL_THREADS && (USE_PTHREAD || USE_EPOLL) */
 
 #if defined (USE_WIN32) && defined(OPENSSL_FIPS)
 #define USE_FIPS
@@ -417,6 +466,7 @@ extern char *sys_errlist[];
 #include <openssl/err.h>
 #include <openssl/crypto.h> /* for CRYPTO_* and SSLeay_version */
 #include <openssl/rand.h>
+#include <openssl/hmac.h>
 #ifndef OPENSSL_NO_MD4
 #include <openssl/md4.h>
 #endif
@@ -454,6 +504,38 @@ extern char *sys_errlist[];
 STACK_OF(SSL_COMP) *SSL_COMP_get_compression_methods(void);
 #endif /* OPENSSL_NO_COMP */
 
+#if defined(HAVE_OSSL_OCSP_H) && !defined(OPENSSL_NO_TLSEXT) && \
+    OPENSSL_VERSION_NUMBER>=0x10002000L && !defined(USE_FORK)
+/* stapled responses are refreshed by a background context */
+#define USE_OCSP_STAPLING
+#endif /* HAVE_OSSL_OCSP_H && !OPENSSL_NO_TLSEXT && OpenSSL>=1.0.2 */
+
+/* key workers are untested, so they are only built with -DUSE_ASYNC_KEYS */
+#ifdef USE_ASYNC_KEYS
+#if (defined(USE_PTHREAD) || defined(USE_EPOLL)) && \
+    OPENSSL_VERSION_NUMBER>=0x10100000L && !defined(OPENSSL_NO_ASYNC) && \
+    !defined(OPENSSL_NO_DEPRECATED_3_0)
+/* private key operations can be offloaded to key worker threads */
+/* handshakes waiting for a key worker are paused in OpenSSL async jobs */
+#define USE_ASYNC_JOBS
+#include <openssl/async.h>
+#include <openssl/rsa.h>
+#ifndef OPENSSL_NO_ECDSA
+#include <openssl/ec.h>
+#endif /* OPENSSL_NO_ECDSA */
+#elif defined(USE_EPOLL) && OPENSSL_VERSION_NUMBER>=0x10002000L && \
+    OPENSSL_VERSION_NUMBER<0x10100000L
+/* private key operations can be offloaded to key worker threads */
+/* handshakes waiting for a key worker are suspended in s_poll_wait() */
+#include <openssl/rsa.h>
+#ifndef OPENSSL_NO_ECDSA
+#include <openssl/ecdsa.h>
+#endif /* OPENSSL_NO_ECDSA */
+#else /* not supported by this threading model and OpenSSL version */
+#undef USE_ASYNC_KEYS
+#endif /* OpenSSL>=1.1.0 async jobs or EPOLL && OpenSSL>=1.0.2 */
+#endif /* USE_ASYNC_KEYS */
+
 /**************************************** other defines */
 
 /* always use IPv4 defaults! */
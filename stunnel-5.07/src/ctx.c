@@ -40,12 +40,66 @@
 
 /**************************************** prototypes */
 
+#ifdef USE_ASYNC_KEYS
+/* maximum input or output of a private key operation (16384-bit RSA) */
+#define KEYJOB_SIZE 2048
+
+typedef enum {
+    KEYJOB_RSA_ENC, KEYJOB_RSA_DEC
+#ifndef OPENSSL_NO_ECDSA
+    , KEYJOB_EC_SIGN
+#endif /* OPENSSL_NO_ECDSA */
+} KEYJOB_TYPE;
+
+typedef struct {
+    KEYOP op; /* has to be the first member */
+    KEYJOB_TYPE type;
+    RSA *rsa;
+#ifndef OPENSSL_NO_ECDSA
+    EC_KEY *ec;
+#ifdef USE_ASYNC_JOBS
+    int digest_type;
+#else /* USE_ASYNC_JOBS */
+    ECDSA_SIG *sig;
+#endif /* USE_ASYNC_JOBS */
+#endif /* OPENSSL_NO_ECDSA */
+    int padding, in_len, result;
+    unsigned int out_len;
+    unsigned long error;
+    unsigned char in[KEYJOB_SIZE], out[KEYJOB_SIZE];
+} KEYJOB;
+#endif /* USE_ASYNC_KEYS */
+
 /* SNI */
 #ifndef OPENSSL_NO_TLSEXT
 NOEXPORT int servername_cb(SSL *, int *, void *);
 NOEXPORT int matches_wildcard(char *, char *);
 #endif
 
+/* session tickets */
+#ifndef OPENSSL_NO_TLSEXT
+#define TICKET_NAME_LEN 16
+#define TICKET_SECRETS_MAX 8
+/* current, next, and up to 6 retired rotation periods of each secret */
+#define TICKET_PERIODS_MAX 8
+#define TICKET_KEYS_MAX (TICKET_SECRETS_MAX*TICKET_PERIODS_MAX)
+
+typedef struct TICKET_KEYS_STRUCTURE {
+    int num;                               /* the first key encrypts tickets */
+    time_t expire[TICKET_KEYS_MAX];    /* end of the grace period (0=never) */
+    unsigned char name[TICKET_KEYS_MAX][TICKET_NAME_LEN];
+    unsigned char keys[TICKET_KEYS_MAX][64];            /* AES and HMAC keys */
+} TICKET_KEYS;
+
+NOEXPORT int ticket_init(SERVICE_OPTIONS *);
+NOEXPORT long ticket_keys_left(SERVICE_OPTIONS *, time_t);
+NOEXPORT TICKET_KEYS *ticket_keys_load(SERVICE_OPTIONS *, time_t);
+NOEXPORT void ticket_key_add(TICKET_KEYS *, char *, int, long, time_t);
+NOEXPORT void ticket_keys_free(TICKET_KEYS *);
+NOEXPORT int ticket_key_cb(SSL *, unsigned char *, unsigned char *,
+    EVP_CIPHER_CTX *, HMAC_CTX *, int);
+#endif
+
 /* DH/ECDH initialization */
 #ifndef OPENSSL_NO_DH
 NOEXPORT int init_dh(SERVICE_OPTIONS *);
@@ -64,14 +118,72 @@ NOEXPORT int load_key_engine(SERVICE_OPTIONS *);
 NOEXPORT int password_cb(char *, int, int, void *);
 #endif
 
+/* asynchronous private key operations */
+#ifdef USE_ASYNC_KEYS
+NOEXPORT int async_key(SERVICE_OPTIONS *);
+NOEXPORT int async_rsa_priv_enc(int, const unsigned char *, unsigned char *,
+    RSA *, int);
+NOEXPORT int async_rsa_priv_dec(int, const unsigned char *, unsigned char *,
+    RSA *, int);
+NOEXPORT int async_rsa(KEYJOB_TYPE, int, const unsigned char *,
+    unsigned char *, RSA *, int);
+#ifndef OPENSSL_NO_ECDSA
+#ifdef USE_ASYNC_JOBS
+NOEXPORT int async_ec_sign(int, const unsigned char *, int, unsigned char *,
+    unsigned int *, const BIGNUM *, const BIGNUM *, EC_KEY *);
+#else /* USE_ASYNC_JOBS */
+NOEXPORT ECDSA_SIG *async_ec_sign(const unsigned char *, int,
+    const BIGNUM *, const BIGNUM *, EC_KEY *);
+NOEXPORT void async_ec_free(void *, void *, CRYPTO_EX_DATA *, int, long,
+    void *);
+#endif /* USE_ASYNC_JOBS */
+#endif /* OPENSSL_NO_ECDSA */
+NOEXPORT KEYJOB *async_job(void);
+NOEXPORT void async_wait(KEYJOB *);
+NOEXPORT void async_run(KEYOP *);
+NOEXPORT void async_free(KEYOP *);
+#ifdef USE_ASYNC_JOBS
+NOEXPORT void async_fd_cleanup(ASYNC_WAIT_CTX *, const void *,
+    OSSL_ASYNC_FD, void *);
+#endif /* USE_ASYNC_JOBS */
+#endif /* USE_ASYNC_KEYS */
+
 /* session cache callbacks */
 NOEXPORT int sess_new_cb(SSL *, SSL_SESSION *);
 NOEXPORT SSL_SESSION *sess_get_cb(SSL *, unsigned char *, int, int *);
 NOEXPORT void sess_remove_cb(SSL_CTX *, SSL_SESSION *);
-NOEXPORT void cache_transfer(SSL_CTX *, const unsigned int, const unsigned,
+NOEXPORT void cache_transfer(SSL_CTX *,
+    const unsigned int, const unsigned,
+    const unsigned char *, const unsigned int,
+    const unsigned char *, const unsigned int,
+    unsigned char **, unsigned int *);
+NOEXPORT int sessiond_socket(SERVICE_OPTIONS *);
+NOEXPORT void sessiond_release(SERVICE_OPTIONS *, int);
+NOEXPORT unsigned long sessiond_msec(void);
+
+/* session cache of the service */
+NOEXPORT char *session_id_key(SSL_SESSION *);
+NOEXPORT unsigned int session_stripe(const char *);
+NOEXPORT CACHED_SESSION *session_cache_find(SESSION_STRIPE *, const char *);
+NOEXPORT void session_cache_unlink(SESSION_STRIPE *, CACHED_SESSION *);
+NOEXPORT void session_cache_remove(SERVICE_OPTIONS *, const char *);
+#ifndef USE_WIN32
+NOEXPORT int shm_cache_init(SERVICE_OPTIONS *);
+NOEXPORT void shm_cache_new(SERVICE_OPTIONS *, const unsigned int,
     const unsigned char *, const unsigned int,
+    const unsigned char *, const unsigned int);
+NOEXPORT void shm_cache_get(SERVICE_OPTIONS *,
     const unsigned char *, const unsigned int,
     unsigned char **, unsigned int *);
+NOEXPORT void shm_cache_remove(SERVICE_OPTIONS *,
+    const unsigned char *, const unsigned int);
+NOEXPORT struct SHM_ENTRY_STRUCTURE *shm_cache_find(SERVICE_OPTIONS *,
+    const unsigned char *, const unsigned int, int);
+NOEXPORT unsigned int shm_cache_hash(const unsigned char *,
+    const unsigned int);
+NOEXPORT int shm_cache_lock(SERVICE_OPTIONS *, unsigned int);
+NOEXPORT void shm_cache_unlock(SERVICE_OPTIONS *, unsigned int);
+#endif /* !USE_WIN32 */
 
 /* info callbacks */
 NOEXPORT void info_callback(
@@ -115,6 +227,11 @@ int context_init(SERVICE_OPTIONS *section) { /* init SSL context */
     if(verify_init(section))
         return 1; /* FAILED */
 
+#ifdef USE_OCSP_STAPLING
+    if(section->option.ocsp_stapling && ocsp_staple_init(section))
+        return 1; /* FAILED */
+#endif
+
     /* initialize DH/ECDH server mode */
     if(!section->option.client) {
 #ifndef OPENSSL_NO_TLSEXT
@@ -140,13 +257,30 @@ int context_init(SERVICE_OPTIONS *section) { /* init SSL context */
             return 1; /* FAILED */
         }
     }
+#ifndef OPENSSL_NO_TLSEXT
+    if(section->ticket_key_file && ticket_init(section))
+        return 1; /* FAILED */
+#endif
     SSL_CTX_set_session_cache_mode(section->ctx, SSL_SESS_CACHE_BOTH);
     SSL_CTX_sess_set_cache_size(section->ctx, section->session_size);
     SSL_CTX_set_timeout(section->ctx, section->session_timeout);
+#ifndef USE_WIN32
+    if(section->session_shm && !section->option.client) {
+        if(shm_cache_init(section))
+            return 1; /* FAILED */
+        SSL_CTX_sess_set_new_cb(section->ctx, sess_new_cb);
+        SSL_CTX_sess_set_get_cb(section->ctx, sess_get_cb);
+        SSL_CTX_sess_set_remove_cb(section->ctx, sess_remove_cb);
+    } else
+#endif /* !USE_WIN32 */
     if(section->option.sessiond) {
         SSL_CTX_sess_set_new_cb(section->ctx, sess_new_cb);
         SSL_CTX_sess_set_get_cb(section->ctx, sess_get_cb);
         SSL_CTX_sess_set_remove_cb(section->ctx, sess_remove_cb);
+    } else if(section->session_file && !section->option.client) {
+        /* the internal cache is looked up without a get callback */
+        SSL_CTX_sess_set_new_cb(section->ctx, sess_new_cb);
+        SSL_CTX_sess_set_remove_cb(section->ctx, sess_remove_cb);
     }
 
     /* set info callback */
@@ -172,6 +306,11 @@ int context_init(SERVICE_OPTIONS *section) { /* init SSL context */
     SSL_CTX_set_mode(section->ctx,
         SSL_MODE_ENABLE_PARTIAL_WRITE |
         SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#endif
+#ifdef SSL_MODE_RELEASE_BUFFERS
+    /* with bufferRelease, buffers are only released on idle connections */
+    if(section->buffer_release)
+        SSL_CTX_clear_mode(section->ctx, SSL_MODE_RELEASE_BUFFERS);
 #endif
     return 0; /* OK */
 }
@@ -243,6 +382,205 @@ NOEXPORT int matches_wildcard(char *servername, char *pattern) {
 
 #endif /* OPENSSL_NO_TLSEXT */
 
+/**************************************** session tickets */
+
+#ifndef OPENSSL_NO_TLSEXT
+
+NOEXPORT int ticket_init(SERVICE_OPTIONS *section) {
+    time_t now=time(NULL);
+
+    section->ticket_keys=ticket_keys_load(section, now);
+    if(!section->ticket_keys)
+        return 1; /* FAILED */
+    section->ticket_keys_loaded=now;
+    if(section->ticket_key_rotate)
+        section->ticket_keys_period=(long)(now/section->ticket_key_rotate);
+    SSL_CTX_set_tlsext_ticket_key_cb(section->ctx, ticket_key_cb);
+    s_log(LOG_INFO, "%s: %d session ticket key(s) loaded",
+        section->ticket_key_file, section->ticket_keys->num);
+    return 0; /* OK */
+}
+
+/* re-read ticketKeyFile or rotate the keys, return seconds to the next time */
+int ticket_keys_timer(SERVICE_OPTIONS *section) {
+    TICKET_KEYS *keys, *old;
+    time_t now=time(NULL);
+    long left;
+
+    left=ticket_keys_left(section, now);
+    if(left>0)
+        return (int)left;
+    section->ticket_keys_loaded=now;
+    if(section->ticket_key_rotate)
+        section->ticket_keys_period=(long)(now/section->ticket_key_rotate);
+    keys=ticket_keys_load(section, now);
+    if(!keys) /* keep the previous keys */
+        return (int)ticket_keys_left(section, now);
+    enter_critical_section(CRIT_TICKET);
+    old=section->ticket_keys;
+    section->ticket_keys=keys;
+    leave_critical_section(CRIT_TICKET);
+    ticket_keys_free(old);
+    s_log(LOG_DEBUG, "%s: %d session ticket key(s) reloaded",
+        section->ticket_key_file, keys->num);
+    return (int)ticket_keys_left(section, now);
+}
+
+/* seconds to the next read of ticketKeyFile or the next rotation period */
+NOEXPORT long ticket_keys_left(SERVICE_OPTIONS *section, time_t now) {
+    long left, period_left;
+
+    left=(long)(section->ticket_keys_loaded+section->ticket_key_reload-now);
+    if(section->ticket_key_rotate) {
+        period_left=(long)((time_t)(section->ticket_keys_period+1)*
+            section->ticket_key_rotate-now);
+        if(period_left<left)
+            left=period_left;
+    }
+    return left;
+}
+
+/* each line of the file holds a secret to derive ticket keys from */
+NOEXPORT TICKET_KEYS *ticket_keys_load(SERVICE_OPTIONS *section, time_t now) {
+    DISK_FILE *df;
+    TICKET_KEYS *keys;
+    char line[1024];
+    int line_len, line_no=0, secrets=0;
+    long period, p;
+    time_t expire;
+
+    df=file_open(section->ticket_key_file, FILE_MODE_READ);
+    if(!df) {
+        ioerror(section->ticket_key_file);
+        return NULL; /* FAILED */
+    }
+    keys=str_alloc(sizeof(TICKET_KEYS));
+    str_detach(keys); /* released by ticket_keys_free() */
+    while((line_len=file_getline(df, line, sizeof line))>=0) {
+        ++line_no;
+        if(!line_len) /* skip empty lines */
+            continue;
+        if(line_len<32) {
+            s_log(LOG_ERR, "%s:%d: Ticket key secret shorter than 32 characters",
+                section->ticket_key_file, line_no);
+            break;
+        }
+        if(secrets>=TICKET_SECRETS_MAX) {
+            s_log(LOG_ERR, "%s:%d: More than %d ticket key secrets",
+                section->ticket_key_file, line_no, TICKET_SECRETS_MAX);
+            break;
+        }
+        ++secrets;
+        if(!section->ticket_key_rotate) { /* a single static key */
+            ticket_key_add(keys, line, line_len, -1, 0);
+            continue;
+        }
+        /* the current period first, so that it encrypts new tickets */
+        period=(long)(now/section->ticket_key_rotate);
+        ticket_key_add(keys, line, line_len, period, 0);
+        /* accepted in case the clock of another server is ahead */
+        ticket_key_add(keys, line, line_len, period+1, 0);
+        /* retired periods are accepted for ticketKeyGrace seconds */
+        for(p=period-1; p>=0 && p>period-(TICKET_PERIODS_MAX-1); --p) {
+            expire=(time_t)(p+1)*section->ticket_key_rotate+
+                section->ticket_key_grace;
+            if(expire<=now)
+                break;
+            ticket_key_add(keys, line, line_len, p, expire);
+        }
+    }
+    file_close(df);
+    OPENSSL_cleanse(line, sizeof line);
+    if(line_len>=0 || !keys->num) { /* a line was rejected or no keys */
+        if(!keys->num)
+            s_log(LOG_ERR, "%s: No ticket key secrets",
+                section->ticket_key_file);
+        ticket_keys_free(keys);
+        return NULL; /* FAILED */
+    }
+    return keys;
+}
+
+/* derive the ticket key of a secret for a rotation period (-1=none) */
+NOEXPORT void ticket_key_add(TICKET_KEYS *keys, char *secret, int secret_len,
+        long period, time_t expire) {
+    unsigned char data[9], digest[EVP_MAX_MD_SIZE];
+    unsigned int data_len=1, len;
+    unsigned long n;
+    int i;
+
+    if(period>=0) { /* big-endian period number, the same on every server */
+        n=(unsigned long)period;
+        for(i=8; i>0; --i) {
+            data[i]=(unsigned char)(n&0xff);
+            n>>=8;
+        }
+        data_len=9;
+    }
+    data[0]='N';
+    HMAC(EVP_sha256(), secret, secret_len, data, data_len, digest, &len);
+    memcpy(keys->name[keys->num], digest, TICKET_NAME_LEN);
+    data[0]='K';
+    HMAC(EVP_sha512(), secret, secret_len, data, data_len,
+        keys->keys[keys->num], &len);
+    keys->expire[keys->num]=expire;
+    keys->num++;
+    OPENSSL_cleanse(digest, sizeof digest);
+}
+
+NOEXPORT void ticket_keys_free(TICKET_KEYS *keys) {
+    if(!keys)
+        return;
+    OPENSSL_cleanse(keys, sizeof(TICKET_KEYS));
+    str_free(keys);
+}
+
+NOEXPORT int ticket_key_cb(SSL *ssl, unsigned char *name, unsigned char *iv,
+        EVP_CIPHER_CTX *ctx, HMAC_CTX *hctx, int enc) {
+    SERVICE_OPTIONS *section;
+    unsigned char keys[64];
+    int i, found, result=1;
+    time_t now;
+
+    section=SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), opt_index);
+    if(!section || !section->ticket_keys)
+        return 0; /* no ticket */
+
+    if(enc) { /* encrypt a new ticket with the current key */
+        if(RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc()))<=0)
+            return -1; /* error */
+        enter_critical_section(CRIT_TICKET);
+        memcpy(name, section->ticket_keys->name[0], TICKET_NAME_LEN);
+        memcpy(keys, section->ticket_keys->keys[0], sizeof keys);
+        leave_critical_section(CRIT_TICKET);
+    } else { /* find the key of a received ticket */
+        now=time(NULL);
+        enter_critical_section(CRIT_TICKET);
+        for(i=0; i<section->ticket_keys->num; i++)
+            if(!safe_memcmp(name, section->ticket_keys->name[i],
+                    TICKET_NAME_LEN))
+                break;
+        found=i<section->ticket_keys->num && /* grace period not expired */
+            (!section->ticket_keys->expire[i] ||
+            section->ticket_keys->expire[i]>now);
+        if(found)
+            memcpy(keys, section->ticket_keys->keys[i], sizeof keys);
+        leave_critical_section(CRIT_TICKET);
+        if(!found)
+            return 0; /* unknown key: perform a full handshake */
+        if(i>0)
+            result=2; /* renew the ticket with the current key */
+    }
+
+    if(!HMAC_Init_ex(hctx, keys+32, 32, EVP_sha256(), NULL) ||
+            !EVP_CipherInit_ex(ctx, EVP_aes_256_cbc(), NULL, keys, iv, enc))
+        result=-1; /* error */
+    OPENSSL_cleanse(keys, sizeof keys);
+    return result;
+}
+
+#endif /* OPENSSL_NO_TLSEXT */
+
 /**************************************** DH initialization */
 
 #ifndef OPENSSL_NO_DH
@@ -386,6 +724,10 @@ NOEXPORT int load_cert(SERVICE_OPTIONS *section) {
     {
         if(load_key_file(section))
             return 1; /* FAILED */
+#ifdef USE_ASYNC_KEYS
+        if(async_key(section))
+            return 1; /* FAILED */
+#endif /* USE_ASYNC_KEYS */
     }
 
     /* validate the private key */
@@ -512,6 +854,430 @@ NOEXPORT int password_cb(char *buf, int size, int rwflag, void *userdata) {
 }
 #endif
 
+/**************************************** asynchronous private key operations */
+
+#ifdef USE_ASYNC_KEYS
+
+#if OPENSSL_VERSION_NUMBER<0x10100000L
+#define RSA_PKCS1_OpenSSL RSA_PKCS1_SSLeay
+#endif /* OpenSSL<1.1.0 */
+
+static RSA_METHOD *async_rsa_method=NULL;
+static int (*rsa_priv_enc)(int, const unsigned char *, unsigned char *,
+    RSA *, int)=NULL;
+static int (*rsa_priv_dec)(int, const unsigned char *, unsigned char *,
+    RSA *, int)=NULL;
+#ifndef OPENSSL_NO_ECDSA
+#ifdef USE_ASYNC_JOBS
+static EC_KEY_METHOD *async_ec_method=NULL;
+static int (*ec_sign)(int, const unsigned char *, int, unsigned char *,
+    unsigned int *, const BIGNUM *, const BIGNUM *, EC_KEY *)=NULL;
+#else /* USE_ASYNC_JOBS */
+static ECDSA_METHOD *async_ec_method=NULL;
+static int async_ec_index=-1; /* the original key of a wrapped EC_KEY */
+#endif /* USE_ASYNC_JOBS */
+#endif /* OPENSSL_NO_ECDSA */
+#ifdef USE_ASYNC_JOBS
+static const char async_fd_key[]="stunnel key worker";
+#endif /* USE_ASYNC_JOBS */
+
+/* replace the loaded private key with a copy using the key workers */
+NOEXPORT int async_key(SERVICE_OPTIONS *section) {
+    EVP_PKEY *pkey, *async_pkey=NULL;
+    RSA *rsa;
+#ifndef OPENSSL_NO_ECDSA
+    EC_KEY *ec;
+#ifdef USE_ASYNC_JOBS
+    int (*sign_setup)(EC_KEY *, BN_CTX *, BIGNUM **, BIGNUM **);
+    ECDSA_SIG *(*sign_sig)(const unsigned char *, int,
+        const BIGNUM *, const BIGNUM *, EC_KEY *);
+#else /* USE_ASYNC_JOBS */
+    EC_KEY *async_ec;
+#endif /* USE_ASYNC_JOBS */
+#endif /* OPENSSL_NO_ECDSA */
+
+    if(!section->option.async_keys)
+        return 0; /* OK: private key operations are executed inline */
+    pkey=SSL_CTX_get0_privatekey(section->ctx);
+    if(!pkey)
+        return 0; /* OK */
+
+    switch(EVP_PKEY_base_id(pkey)) {
+    case EVP_PKEY_RSA:
+        if(!async_rsa_method) {
+#ifdef USE_ASYNC_JOBS
+            async_rsa_method=RSA_meth_dup(RSA_PKCS1_OpenSSL());
+            if(!async_rsa_method) {
+                sslerror("RSA_meth_dup");
+                return 1; /* FAILED */
+            }
+            rsa_priv_enc=RSA_meth_get_priv_enc(RSA_PKCS1_OpenSSL());
+            rsa_priv_dec=RSA_meth_get_priv_dec(RSA_PKCS1_OpenSSL());
+            RSA_meth_set_priv_enc(async_rsa_method, async_rsa_priv_enc);
+            RSA_meth_set_priv_dec(async_rsa_method, async_rsa_priv_dec);
+#else /* USE_ASYNC_JOBS */
+            /* RSA_METHOD is not opaque before OpenSSL 1.1.0 */
+            async_rsa_method=str_alloc(sizeof(RSA_METHOD));
+            str_detach(async_rsa_method); /* used until the process exits */
+            *async_rsa_method=*RSA_PKCS1_OpenSSL();
+            rsa_priv_enc=async_rsa_method->rsa_priv_enc;
+            rsa_priv_dec=async_rsa_method->rsa_priv_dec;
+            async_rsa_method->rsa_priv_enc=async_rsa_priv_enc;
+            async_rsa_method->rsa_priv_dec=async_rsa_priv_dec;
+#endif /* USE_ASYNC_JOBS */
+        }
+        rsa=EVP_PKEY_get1_RSA(pkey);
+        if(!rsa)
+            break;
+        /* keys handled by an engine are used directly */
+        if(RSA_get_method(rsa)==RSA_PKCS1_OpenSSL() &&
+                RSA_set_method(rsa, async_rsa_method)) {
+            async_pkey=EVP_PKEY_new();
+            if(async_pkey && !EVP_PKEY_set1_RSA(async_pkey, rsa)) {
+                EVP_PKEY_free(async_pkey);
+                async_pkey=NULL;
+            }
+        }
+        RSA_free(rsa);
+        break;
+#ifndef OPENSSL_NO_ECDSA
+    case EVP_PKEY_EC:
+#ifdef USE_ASYNC_JOBS
+        if(!async_ec_method) {
+            async_ec_method=EC_KEY_METHOD_new(EC_KEY_OpenSSL());
+            if(!async_ec_method) {
+                sslerror("EC_KEY_METHOD_new");
+                return 1; /* FAILED */
+            }
+            EC_KEY_METHOD_get_sign((EC_KEY_METHOD *)EC_KEY_OpenSSL(),
+                &ec_sign, &sign_setup, &sign_sig);
+            EC_KEY_METHOD_set_sign(async_ec_method,
+                async_ec_sign, sign_setup, sign_sig);
+        }
+        ec=EVP_PKEY_get1_EC_KEY(pkey);
+        if(!ec)
+            break;
+        if(EC_KEY_get_method(ec)==EC_KEY_OpenSSL() &&
+                EC_KEY_set_method(ec, async_ec_method)) {
+            async_pkey=EVP_PKEY_new();
+            if(async_pkey && !EVP_PKEY_set1_EC_KEY(async_pkey, ec)) {
+                EVP_PKEY_free(async_pkey);
+                async_pkey=NULL;
+            }
+        }
+        EC_KEY_free(ec);
+#else /* USE_ASYNC_JOBS */
+        if(!async_ec_method) {
+            async_ec_method=ECDSA_METHOD_new(ECDSA_OpenSSL());
+            if(!async_ec_method) {
+                sslerror("ECDSA_METHOD_new");
+                return 1; /* FAILED */
+            }
+            ECDSA_METHOD_set_sign(async_ec_method, async_ec_sign);
+            async_ec_index=ECDSA_get_ex_new_index(0, "original key",
+                NULL, NULL, async_ec_free);
+        }
+        ec=EVP_PKEY_get1_EC_KEY(pkey);
+        if(!ec)
+            break;
+        /* the replaced ECDSA_METHOD cannot be called directly, so a copy */
+        /* of the key uses the key workers, and they sign with the original */
+        async_ec=EC_KEY_dup(ec);
+        if(async_ec && ECDSA_set_method(async_ec, async_ec_method) &&
+                ECDSA_set_ex_data(async_ec, async_ec_index, ec)) {
+            ec=NULL; /* released with async_ec by async_ec_free() */
+            async_pkey=EVP_PKEY_new();
+            if(async_pkey && !EVP_PKEY_set1_EC_KEY(async_pkey, async_ec)) {
+                EVP_PKEY_free(async_pkey);
+                async_pkey=NULL;
+            }
+        }
+        if(async_ec)
+            EC_KEY_free(async_ec);
+        if(ec)
+            EC_KEY_free(ec);
+#endif /* USE_ASYNC_JOBS */
+        break;
+#endif /* OPENSSL_NO_ECDSA */
+    default:
+        break;
+    }
+    ERR_clear_error();
+    if(!async_pkey) {
+        s_log(LOG_INFO, "Private key operations cannot use key workers");
+        return 0; /* OK: private key operations are executed inline */
+    }
+
+    if(!SSL_CTX_use_PrivateKey(section->ctx, async_pkey)) {
+        sslerror("SSL_CTX_use_PrivateKey");
+        EVP_PKEY_free(async_pkey);
+        return 1; /* FAILED */
+    }
+    EVP_PKEY_free(async_pkey);
+#ifdef USE_ASYNC_JOBS
+    SSL_CTX_set_mode(section->ctx, SSL_MODE_ASYNC);
+#endif /* USE_ASYNC_JOBS */
+    s_log(LOG_DEBUG, "Private key operations offloaded to key workers");
+    return 0; /* OK */
+}
+
+NOEXPORT int async_rsa_priv_enc(int flen, const unsigned char *from,
+        unsigned char *to, RSA *rsa, int padding) {
+    return async_rsa(KEYJOB_RSA_ENC, flen, from, to, rsa, padding);
+}
+
+NOEXPORT int async_rsa_priv_dec(int flen, const unsigned char *from,
+        unsigned char *to, RSA *rsa, int padding) {
+    return async_rsa(KEYJOB_RSA_DEC, flen, from, to, rsa, padding);
+}
+
+NOEXPORT int async_rsa(KEYJOB_TYPE type, int flen, const unsigned char *from,
+        unsigned char *to, RSA *rsa, int padding) {
+    KEYJOB *job=NULL;
+    int result;
+
+    if(flen>=0 && flen<=KEYJOB_SIZE && RSA_size(rsa)<=KEYJOB_SIZE)
+        job=async_job();
+    if(!job) /* not called from an asynchronous SSL operation */
+        return type==KEYJOB_RSA_ENC ?
+            rsa_priv_enc(flen, from, to, rsa, padding) :
+            rsa_priv_dec(flen, from, to, rsa, padding);
+
+    job->type=type;
+    job->rsa=rsa;
+#ifdef USE_ASYNC_JOBS
+    RSA_up_ref(rsa); /* released by async_run() */
+#endif /* USE_ASYNC_JOBS */
+    memcpy(job->in, from, flen);
+    job->in_len=flen;
+    job->padding=padding;
+    async_wait(job);
+    result=job->result;
+    if(result>0)
+        memcpy(to, job->out, result);
+#ifndef USE_ASYNC_JOBS
+    async_free(&job->op);
+#endif /* !USE_ASYNC_JOBS */
+    return result;
+}
+
+#ifndef OPENSSL_NO_ECDSA
+#ifdef USE_ASYNC_JOBS
+
+NOEXPORT int async_ec_sign(int type, const unsigned char *dgst, int dlen,
+        unsigned char *sig, unsigned int *siglen,
+        const BIGNUM *kinv, const BIGNUM *r, EC_KEY *ec) {
+    KEYJOB *job=NULL;
+
+    if(!kinv && !r && dlen>=0 && dlen<=KEYJOB_SIZE &&
+            ECDSA_size(ec)<=KEYJOB_SIZE)
+        job=async_job();
+    if(!job) /* not called from an asynchronous SSL operation */
+        return ec_sign(type, dgst, dlen, sig, siglen, kinv, r, ec);
+
+    job->type=KEYJOB_EC_SIGN;
+    job->ec=ec;
+    EC_KEY_up_ref(ec); /* released by async_run() */
+    job->digest_type=type;
+    memcpy(job->in, dgst, dlen);
+    job->in_len=dlen;
+    async_wait(job);
+    if(job->result>0) {
+        memcpy(sig, job->out, job->out_len);
+        *siglen=job->out_len;
+    } else {
+        *siglen=0;
+    }
+    return job->result;
+}
+
+#else /* USE_ASYNC_JOBS */
+
+NOEXPORT ECDSA_SIG *async_ec_sign(const unsigned char *dgst, int dlen,
+        const BIGNUM *kinv, const BIGNUM *r, EC_KEY *ec) {
+    KEYJOB *job=NULL;
+    EC_KEY *key;
+    ECDSA_SIG *sig;
+
+    key=ECDSA_get_ex_data(ec, async_ec_index);
+    if(!key) /* should not ever happen */
+        return NULL;
+    if(!kinv && !r && dlen>=0 && dlen<=KEYJOB_SIZE)
+        job=async_job();
+    if(!job) /* not called from a reactor context */
+        return ECDSA_do_sign_ex(dgst, dlen, kinv, r, key);
+
+    job->type=KEYJOB_EC_SIGN;
+    job->ec=key;
+    memcpy(job->in, dgst, dlen);
+    job->in_len=dlen;
+    async_wait(job);
+    sig=job->sig;
+    async_free(&job->op);
+    return sig;
+}
+
+/* invoked by EC_KEY_free() of the key using async_ec_method */
+NOEXPORT void async_ec_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+        int idx, long argl, void *argp) {
+    (void)parent; /* skip warning about unused parameter */
+    (void)ad; /* skip warning about unused parameter */
+    (void)idx; /* skip warning about unused parameter */
+    (void)argl; /* skip warning about unused parameter */
+    (void)argp; /* skip warning about unused parameter */
+    if(ptr)
+        EC_KEY_free(ptr);
+}
+
+#endif /* USE_ASYNC_JOBS */
+#endif /* OPENSSL_NO_ECDSA */
+
+#ifdef USE_ASYNC_JOBS
+
+/* return the key worker job of the current SSL object */
+NOEXPORT KEYJOB *async_job(void) {
+    ASYNC_JOB *current;
+    ASYNC_WAIT_CTX *waitctx;
+    OSSL_ASYNC_FD fd;
+    void *data;
+    KEYJOB *job;
+
+    current=ASYNC_get_current_job();
+    if(!current)
+        return NULL;
+    waitctx=ASYNC_get_wait_ctx(current);
+    if(!waitctx)
+        return NULL;
+    if(ASYNC_WAIT_CTX_get_fd(waitctx, async_fd_key, &fd, &data))
+        return data; /* reuse the job allocated for this SSL object */
+
+    job=str_alloc(sizeof(KEYJOB));
+    str_detach(job); /* released by async_free() */
+    job->op.func=async_run;
+    job->op.cleanup=async_free;
+    if(s_pipe(job->op.wakeup, 1, "async_job: s_pipe")) {
+        str_free(job);
+        return NULL;
+    }
+    if(!ASYNC_WAIT_CTX_set_wait_fd(waitctx, async_fd_key,
+            job->op.wakeup[0], job, async_fd_cleanup)) {
+        sslerror("ASYNC_WAIT_CTX_set_wait_fd");
+        async_free(&job->op);
+        return NULL;
+    }
+    return job;
+}
+
+/* the SSL operation returns SSL_ERROR_WANT_ASYNC until the job is done */
+NOEXPORT void async_wait(KEYJOB *job) {
+    char c;
+
+    if(keyop_queue(&job->op)) { /* key workers are not started */
+        async_run(&job->op);
+    } else {
+        do {
+            ASYNC_pause_job();
+        } while(read(job->op.wakeup[0], &c, 1)!=1);
+    }
+    if(job->error)
+        sslerror_log(job->error, "Private key operation");
+}
+
+#else /* USE_ASYNC_JOBS */
+
+/* return a new key worker job, released by its caller */
+NOEXPORT KEYJOB *async_job(void) {
+    KEYJOB *job;
+
+    if(!current_context()) /* not running on a reactor thread */
+        return NULL;
+    job=str_alloc(sizeof(KEYJOB));
+    job->op.func=async_run;
+    job->op.cleanup=async_free;
+    if(s_pipe(job->op.wakeup, 1, "async_job: s_pipe")) {
+        str_free(job);
+        return NULL;
+    }
+    return job;
+}
+
+/* the reactor serves other contexts until the job is done */
+NOEXPORT void async_wait(KEYJOB *job) {
+    s_poll_set *fds;
+    char c;
+
+    if(keyop_queue(&job->op)) { /* key workers are not started */
+        async_run(&job->op);
+    } else {
+        fds=s_poll_alloc();
+        do {
+            s_poll_init(fds);
+            s_poll_add(fds, job->op.wakeup[0], 1, 0);
+            s_poll_wait(fds, -1, 0); /* the key worker always signals */
+        } while(read(job->op.wakeup[0], &c, 1)!=1);
+        s_poll_free(fds);
+    }
+    if(job->error)
+        sslerror_log(job->error, "Private key operation");
+}
+
+#endif /* USE_ASYNC_JOBS */
+
+/* executed by a key worker thread */
+NOEXPORT void async_run(KEYOP *op) {
+    KEYJOB *job=(KEYJOB *)op;
+
+    switch(job->type) {
+    case KEYJOB_RSA_ENC:
+        job->result=rsa_priv_enc(job->in_len,
+            job->in, job->out, job->rsa, job->padding);
+#ifdef USE_ASYNC_JOBS
+        RSA_free(job->rsa);
+#endif /* USE_ASYNC_JOBS */
+        break;
+    case KEYJOB_RSA_DEC:
+        job->result=rsa_priv_dec(job->in_len,
+            job->in, job->out, job->rsa, job->padding);
+#ifdef USE_ASYNC_JOBS
+        RSA_free(job->rsa);
+#endif /* USE_ASYNC_JOBS */
+        break;
+#ifndef OPENSSL_NO_ECDSA
+    case KEYJOB_EC_SIGN:
+#ifdef USE_ASYNC_JOBS
+        job->result=ec_sign(job->digest_type, job->in, job->in_len,
+            job->out, &job->out_len, NULL, NULL, job->ec);
+        EC_KEY_free(job->ec);
+#else /* USE_ASYNC_JOBS */
+        job->sig=ECDSA_do_sign(job->in, job->in_len, job->ec);
+        job->result=job->sig!=NULL;
+#endif /* USE_ASYNC_JOBS */
+        break;
+#endif /* OPENSSL_NO_ECDSA */
+    }
+    job->error=ERR_get_error(); /* errors are logged by async_wait() */
+    ERR_clear_error();
+}
+
+NOEXPORT void async_free(KEYOP *op) {
+    close(op->wakeup[0]);
+    close(op->wakeup[1]);
+    str_free(op);
+}
+
+#ifdef USE_ASYNC_JOBS
+/* invoked by SSL_free(): a pending job is released by its key worker */
+NOEXPORT void async_fd_cleanup(ASYNC_WAIT_CTX *waitctx, const void *key,
+        OSSL_ASYNC_FD fd, void *data) {
+    (void)waitctx; /* skip warning about unused parameter */
+    (void)key; /* skip warning about unused parameter */
+    (void)fd; /* skip warning about unused parameter */
+    keyop_release(data);
+}
+#endif /* USE_ASYNC_JOBS */
+
+#endif /* USE_ASYNC_KEYS */
+
 /**************************************** session cache callbacks */
 
 #define CACHE_CMD_NEW     0x00
@@ -522,14 +1288,34 @@ NOEXPORT int password_cb(char *buf, int size, int rwflag, void *userdata) {
 
 NOEXPORT int sess_new_cb(SSL *ssl, SSL_SESSION *sess) {
     unsigned char *val, *val_tmp;
+    const unsigned char *session_id;
+    unsigned int session_id_length;
     int val_len;
+    SERVICE_OPTIONS *section;
+    char *key;
+
+    section=SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), opt_index);
+    if(section->session_file) { /* mirror the internal cache */
+        key=session_id_key(sess);
+        session_cache_put(section, key, sess);
+        str_free(key);
+        return 1; /* the reference is now owned by the mirror */
+    }
 
     val_len=i2d_SSL_SESSION(sess, NULL);
     val_tmp=val=str_alloc(val_len);
     i2d_SSL_SESSION(sess, &val_tmp);
 
-    cache_transfer(ssl->ctx, CACHE_CMD_NEW, SSL_SESSION_get_timeout(sess),
-        sess->session_id, sess->session_id_length, val, val_len, NULL, NULL);
+    session_id=SSL_SESSION_get_id(sess, &session_id_length);
+#ifndef USE_WIN32
+    if(section->shm_cache)
+        shm_cache_new(section, SSL_SESSION_get_timeout(sess),
+            session_id, session_id_length, val, val_len);
+    else
+#endif
+    cache_transfer(SSL_get_SSL_CTX(ssl), CACHE_CMD_NEW,
+        SSL_SESSION_get_timeout(sess),
+        session_id, session_id_length, val, val_len, NULL, NULL);
     str_free(val);
     return 1; /* leave the session in local cache for reuse */
 }
@@ -539,10 +1325,19 @@ NOEXPORT SSL_SESSION *sess_get_cb(SSL *ssl,
     unsigned char *val, *val_tmp=NULL;
     unsigned int val_len=0;
     SSL_SESSION *sess;
+#ifndef USE_WIN32
+    SERVICE_OPTIONS *section;
+#endif
 
     *do_copy = 0; /* allow the session to be freed autmatically */
-    cache_transfer(ssl->ctx, CACHE_CMD_GET, 0,
-        key, key_len, NULL, 0, &val, &val_len);
+#ifndef USE_WIN32
+    section=SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), opt_index);
+    if(section->shm_cache)
+        shm_cache_get(section, key, key_len, &val, &val_len);
+    else
+#endif
+        cache_transfer(SSL_get_SSL_CTX(ssl), CACHE_CMD_GET, 0,
+            key, key_len, NULL, 0, &val, &val_len);
     if(!val)
         return NULL;
     val_tmp=val;
@@ -556,8 +1351,26 @@ NOEXPORT SSL_SESSION *sess_get_cb(SSL *ssl,
 }
 
 NOEXPORT void sess_remove_cb(SSL_CTX *ctx, SSL_SESSION *sess) {
+    const unsigned char *session_id;
+    unsigned int session_id_length;
+    SERVICE_OPTIONS *section;
+    char *key;
+
+    section=SSL_CTX_get_ex_data(ctx, opt_index);
+    if(section->session_file) {
+        key=session_id_key(sess);
+        session_cache_remove(section, key);
+        str_free(key);
+        return;
+    }
+    session_id=SSL_SESSION_get_id(sess, &session_id_length);
+#ifndef USE_WIN32
+    if(section->shm_cache)
+        shm_cache_remove(section, session_id, session_id_length);
+    else
+#endif
     cache_transfer(ctx, CACHE_CMD_REMOVE, 0,
-        sess->session_id, sess->session_id_length, NULL, 0, NULL, NULL);
+        session_id, session_id_length, NULL, 0, NULL, NULL);
 }
 
 #define MAX_VAL_LEN 512
@@ -568,8 +1381,8 @@ typedef struct {
     u_char val[MAX_VAL_LEN];
 } CACHE_PACKET;
 
-NOEXPORT void cache_transfer(SSL_CTX *ctx, const unsigned int type,
-        const unsigned int timeout,
+/* "new" and "remove" requests are sent without waiting for a response */
+NOEXPORT void cache_transfer(SSL_CTX *ctx, const unsigned int type, const unsigned int timeout,
         const unsigned char *key, const unsigned int key_len,
         const unsigned char *val, const unsigned int val_len,
         unsigned char **ret, unsigned int *ret_len) {
@@ -577,10 +1390,12 @@ NOEXPORT void cache_transfer(SSL_CTX *ctx, const unsigned int type,
     const char hex[16]="0123456789ABCDEF";
     const char *type_description[]={"new", "get", "remove"};
     unsigned int i;
-    int s, len;
-    struct timeval t;
+    int s, len, rounds;
+    long left; /* milliseconds left until the lookup deadline */
+    unsigned long start;
     CACHE_PACKET *packet;
     SERVICE_OPTIONS *section;
+    s_poll_set *fds;
 
     if(ret) /* set error as the default result if required */
         *ret=NULL;
@@ -615,60 +1430,71 @@ NOEXPORT void cache_transfer(SSL_CTX *ctx, const unsigned int type,
     memcpy(packet->key, key, key_len);
     memcpy(packet->val, val, val_len);
 
-    /* create the socket */
-    s=s_socket(AF_INET, SOCK_DGRAM, 0, 0, "cache_transfer: socket");
-    if(s<0) {
-        str_free(packet);
-        return;
-    }
-
     /* retrieve pointer to the section structure of this ctx */
     section=SSL_CTX_get_ex_data(ctx, opt_index);
-    if(sendto(s, (void *)packet, sizeof(CACHE_PACKET)-MAX_VAL_LEN+val_len, 0,
-            &section->sessiond_addr.sa, addr_len(&section->sessiond_addr))<0) {
-        sockerror("cache_transfer: sendto");
-        closesocket(s);
+    s=sessiond_socket(section);
+    if(s<0) {
         str_free(packet);
         return;
     }
-
-    if(!ret || !ret_len) { /* no response is required */
+    if(send(s, (void *)packet, sizeof(CACHE_PACKET)-MAX_VAL_LEN+val_len, 0)<0) {
+        sockerror("cache_transfer: send");
         closesocket(s);
         str_free(packet);
         return;
     }
 
-    /* set recvfrom timeout to 200ms */
-    t.tv_sec=0;
-    t.tv_usec=200;
-    if(setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (void *)&t, sizeof t)<0) {
-        sockerror("cache_transfer: setsockopt SO_RCVTIMEO");
-        closesocket(s);
+    if(!ret || !ret_len) { /* no response is required */
+        sessiond_release(section, s);
         str_free(packet);
         return;
     }
 
-    /* retrieve response */
-    len=recv(s, (void *)packet, sizeof(CACHE_PACKET), 0);
-    closesocket(s);
-    if(len<0) {
-        if(get_last_socket_error()==S_EWOULDBLOCK ||
-                get_last_socket_error()==S_EAGAIN)
+    /* retrieve the response for this session id */
+    /* a private set: the slots of c->fds are kept by transfer() */
+    fds=s_poll_alloc();
+    start=sessiond_msec();
+    for(rounds=0; ; ++rounds) {
+        /* retries only get the time left of a single sessiondTimeout */
+        left=section->sessiond_timeout-(long)(sessiond_msec()-start);
+        s_poll_init(fds);
+        s_poll_add(fds, s, 1, 0);
+        switch(rounds<4 && left>0 ? s_poll_wait(fds, (int)(left/1000),
+                (int)(left%1000)) : 0) {
+        case -1:
+            sockerror("cache_transfer: s_poll_wait");
+            s_poll_free(fds);
+            closesocket(s);
+            str_free(packet);
+            return;
+        case 0:
             s_log(LOG_INFO, "cache_transfer: recv timeout");
-        else
+            s_poll_free(fds);
+            closesocket(s); /* a late response must not reach another lookup */
+            str_free(packet);
+            return;
+        }
+        len=recv(s, (void *)packet, sizeof(CACHE_PACKET), 0);
+        if(len<0) {
+            if(get_last_socket_error()==S_EWOULDBLOCK ||
+                    get_last_socket_error()==S_EAGAIN)
+                continue;
             sockerror("cache_transfer: recv");
-        str_free(packet);
-        return;
+            s_poll_free(fds);
+            closesocket(s);
+            str_free(packet);
+            return;
+        }
+        if(len>=(int)sizeof(CACHE_PACKET)-MAX_VAL_LEN && /* not too short */
+                packet->version==1 && /* right version */
+                !safe_memcmp(packet->key, key, key_len)) /* right session id */
+            break;
+        s_log(LOG_DEBUG, "cache_transfer: malformed packet received");
     }
+    s_poll_free(fds);
+    sessiond_release(section, s);
 
     /* parse results */
-    if(len<(int)sizeof(CACHE_PACKET)-MAX_VAL_LEN || /* too short */
-            packet->version!=1 || /* wrong version */
-            safe_memcmp(packet->key, key, key_len)) { /* wrong session id */
-        s_log(LOG_DEBUG, "cache_transfer: malformed packet received");
-        str_free(packet);
-        return;
-    }
     if(packet->type!=CACHE_RESP_OK) {
         s_log(LOG_INFO, "cache_transfer: session not found");
         str_free(packet);
@@ -681,6 +1507,591 @@ NOEXPORT void cache_transfer(SSL_CTX *ctx, const unsigned int type,
     str_free(packet);
 }
 
+/* get an idle sessiond socket, or connect a new one */
+NOEXPORT int sessiond_socket(SERVICE_OPTIONS *section) {
+    int s=-1;
+
+    enter_critical_section(CRIT_SESSIOND);
+    if(section->sessiond_idle)
+        s=section->sessiond_fd[--section->sessiond_idle];
+    leave_critical_section(CRIT_SESSIOND);
+    if(s>=0)
+        return s;
+
+    s=s_socket(section->sessiond_addr.sa.sa_family, SOCK_DGRAM, 0, 1,
+        "sessiond_socket: socket");
+    if(s<0)
+        return -1;
+    if(connect(s, &section->sessiond_addr.sa,
+            addr_len(&section->sessiond_addr))) {
+        sockerror("sessiond_socket: connect");
+        closesocket(s);
+        return -1;
+    }
+    return s;
+}
+
+NOEXPORT void sessiond_release(SERVICE_OPTIONS *section, int s) {
+    enter_critical_section(CRIT_SESSIOND);
+    if(section->sessiond_idle<SESSIOND_SOCKETS) {
+        section->sessiond_fd[section->sessiond_idle++]=s;
+        s=-1;
+    }
+    leave_critical_section(CRIT_SESSIOND);
+    if(s>=0)
+        closesocket(s);
+}
+
+/* milliseconds since an arbitrary point, only used for time differences */
+NOEXPORT unsigned long sessiond_msec(void) {
+#ifdef USE_WIN32
+    return (unsigned long)GetTickCount();
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (unsigned long)tv.tv_sec*1000+(unsigned long)tv.tv_usec/1000;
+#endif
+}
+
+/**************************************** session cache of the service */
+
+/* client sessions are cached for each destination and SNI, server
+ * sessions are only mirrored here (by session id) to be saved in
+ * sessionFile; each stripe is an LRU list with its own critical section */
+
+NOEXPORT char *session_id_key(SSL_SESSION *sess) {
+    const unsigned char *id;
+    unsigned int i, len;
+    char *key;
+    const char hex[16]="0123456789ABCDEF";
+
+    id=SSL_SESSION_get_id(sess, &len);
+    key=str_alloc(2*len+1);
+    for(i=0; i<len; ++i) {
+        key[2*i]=hex[id[i]>>4];
+        key[2*i+1]=hex[id[i]&0x0f];
+    }
+    key[2*len]='\0';
+    return key;
+}
+
+NOEXPORT unsigned int session_stripe(const char *key) {
+    unsigned int hash=2166136261u; /* FNV-1a */
+
+    while(*key)
+        hash=(hash^(unsigned char)*key++)*16777619u;
+    return hash%SESSION_STRIPES;
+}
+
+NOEXPORT CACHED_SESSION *session_cache_find(SESSION_STRIPE *stripe,
+        const char *key) {
+    CACHED_SESSION *entry;
+
+    for(entry=stripe->head; entry; entry=entry->next)
+        if(!strcmp(entry->key, key))
+            return entry;
+    return NULL;
+}
+
+NOEXPORT void session_cache_unlink(SESSION_STRIPE *stripe,
+        CACHED_SESSION *entry) {
+    if(entry->prev)
+        entry->prev->next=entry->next;
+    else
+        stripe->head=entry->next;
+    if(entry->next)
+        entry->next->prev=entry->prev;
+    else
+        stripe->tail=entry->prev;
+    --stripe->count;
+}
+
+void session_cache_get(SERVICE_OPTIONS *section, const char *key, SSL *ssl) {
+    unsigned int i=session_stripe(key);
+    SESSION_STRIPE *stripe=&section->session[i];
+    CACHED_SESSION *entry;
+
+    enter_critical_section((SECTION_CODE)(CRIT_SESSION+i));
+    entry=session_cache_find(stripe, key);
+    if(entry) {
+        SSL_set_session(ssl, entry->session);
+        if(entry!=stripe->head) { /* move to the front of the LRU list */
+            session_cache_unlink(stripe, entry);
+            entry->prev=NULL;
+            entry->next=stripe->head;
+            stripe->head->prev=entry;
+            stripe->head=entry;
+            ++stripe->count;
+        }
+    }
+    leave_critical_section((SECTION_CODE)(CRIT_SESSION+i));
+    s_log(LOG_DEBUG, "Session cache %s: %s", entry ? "hit" : "miss", key);
+}
+
+/* the reference to the session is passed to the cache */
+void session_cache_put(SERVICE_OPTIONS *section, const char *key,
+        SSL_SESSION *session) {
+    unsigned int i=session_stripe(key);
+    SESSION_STRIPE *stripe=&section->session[i];
+    CACHED_SESSION *entry, *evicted=NULL;
+    SSL_SESSION *old_session=NULL;
+    long limit;
+
+    /* sessionCacheSize of 0 means no limit, as in OpenSSL */
+    limit=(section->session_size+SESSION_STRIPES-1)/SESSION_STRIPES;
+    enter_critical_section((SECTION_CODE)(CRIT_SESSION+i));
+    entry=session_cache_find(stripe, key);
+    if(entry) { /* replace the session, keep the LRU position */
+        old_session=entry->session;
+        entry->session=session;
+    } else {
+        entry=str_alloc(sizeof(CACHED_SESSION));
+        str_detach(entry);
+        entry->key=str_dup(key);
+        str_detach(entry->key);
+        entry->session=session;
+        entry->prev=NULL;
+        entry->next=stripe->head;
+        if(stripe->head)
+            stripe->head->prev=entry;
+        else
+            stripe->tail=entry;
+        stripe->head=entry;
+        if(++stripe->count>limit && limit>0) { /* evict the LRU entry */
+            evicted=stripe->tail;
+            session_cache_unlink(stripe, evicted);
+        }
+    }
+    leave_critical_section((SECTION_CODE)(CRIT_SESSION+i));
+    if(old_session)
+        SSL_SESSION_free(old_session);
+    if(evicted) {
+        s_log(LOG_DEBUG, "Session cache evicted: %s", evicted->key);
+        SSL_SESSION_free(evicted->session);
+        str_free(evicted->key);
+        str_free(evicted);
+    }
+}
+
+NOEXPORT void session_cache_remove(SERVICE_OPTIONS *section, const char *key) {
+    unsigned int i=session_stripe(key);
+    SESSION_STRIPE *stripe=&section->session[i];
+    CACHED_SESSION *entry;
+
+    enter_critical_section((SECTION_CODE)(CRIT_SESSION+i));
+    entry=session_cache_find(stripe, key);
+    if(entry)
+        session_cache_unlink(stripe, entry);
+    leave_critical_section((SECTION_CODE)(CRIT_SESSION+i));
+    if(entry) {
+        SSL_SESSION_free(entry->session);
+        str_free(entry->key);
+        str_free(entry);
+    }
+}
+
+/* each session is stored as its key line followed by a PEM block */
+void session_file_load(SERVICE_OPTIONS *section) {
+    BIO *bio;
+    SSL_SESSION *sess;
+    char key[1024];
+    long now=(long)time(NULL), loaded=0, expired=0;
+
+    bio=BIO_new_file(section->session_file, "r");
+    if(!bio) {
+        ERR_clear_error();
+        s_log(LOG_INFO, "Service [%s]: No sessions loaded from %s",
+            section->servname, section->session_file);
+        return;
+    }
+    while(BIO_gets(bio, key, sizeof key)>0) {
+        key[strcspn(key, "\r\n")]='\0';
+        sess=PEM_read_bio_SSL_SESSION(bio, NULL, NULL, NULL);
+        if(!sess) {
+            sslerror("PEM_read_bio_SSL_SESSION");
+            break;
+        }
+        if(SSL_SESSION_get_time(sess)+SSL_SESSION_get_timeout(sess)<=now) {
+            SSL_SESSION_free(sess);
+            ++expired;
+            continue;
+        }
+        /* SSL_CTX_add_session() takes its own reference */
+        if(!section->option.client && !SSL_CTX_add_session(section->ctx, sess)) {
+            SSL_SESSION_free(sess);
+            continue;
+        }
+        session_cache_put(section, key, sess);
+        ++loaded;
+    }
+    BIO_free(bio);
+    s_log(LOG_NOTICE, "Service [%s]: %ld session(s) loaded, %ld expired",
+        section->servname, loaded, expired);
+}
+
+/* the file is replaced atomically, so a crash never leaves it truncated */
+void session_file_save(SERVICE_OPTIONS *section) {
+    BIO *mem, *bio;
+    CACHED_SESSION *entry;
+    char *tmp, *data;
+    unsigned int i;
+    long len, saved=0;
+#ifndef USE_WIN32
+    int fd;
+#endif
+
+    section->session_file_saved=time(NULL);
+    mem=BIO_new(BIO_s_mem());
+    if(!mem)
+        return;
+    /* serialize in memory to keep the critical sections short */
+    for(i=0; i<SESSION_STRIPES; ++i) {
+        enter_critical_section((SECTION_CODE)(CRIT_SESSION+i));
+        for(entry=section->session[i].tail; entry; entry=entry->prev) {
+            BIO_printf(mem, "%s\n", entry->key);
+            PEM_write_bio_SSL_SESSION(mem, entry->session);
+            ++saved;
+        }
+        leave_critical_section((SECTION_CODE)(CRIT_SESSION+i));
+    }
+    len=BIO_get_mem_data(mem, &data);
+
+    tmp=str_printf("%s.tmp", section->session_file);
+#ifdef USE_WIN32
+    bio=BIO_new_file(tmp, "w");
+#else
+    /* cached sessions contain master secrets */
+    fd=open(tmp, O_CREAT|O_WRONLY|O_TRUNC, 0600);
+    bio=fd<0 ? NULL : BIO_new_fd(fd, BIO_CLOSE);
+    if(!bio && fd>=0)
+        close(fd);
+#endif
+    if(!bio) {
+        ioerror(tmp);
+    } else if((len && BIO_write(bio, data, (int)len)!=len) ||
+            BIO_flush(bio)<=0) {
+        ioerror(tmp);
+        BIO_free(bio);
+    } else {
+        BIO_free(bio);
+#ifdef USE_WIN32
+        remove(section->session_file); /* rename() does not overwrite */
+#endif
+        if(rename(tmp, section->session_file))
+            ioerror(section->session_file);
+        else
+            s_log(LOG_INFO, "Service [%s]: %ld session(s) saved to %s",
+                section->servname, saved, section->session_file);
+    }
+    str_free(tmp);
+    BIO_free(mem);
+}
+
+/**************************************** shared memory session cache */
+
+#ifndef USE_WIN32
+
+/* sessions are hashed to lock stripes of fixed-size entries */
+#define SHM_CACHE_STRIPES 64
+#define SHM_CACHE_PROBES  8
+#define SHM_CACHE_VAL_LEN 2048
+#if defined(USE_PTHREAD) || defined(USE_EPOLL)
+#define SHM_CACHE_MAGIC   0x53544d31 /* process-shared mutexes */
+#else
+#define SHM_CACHE_MAGIC   0x53544631 /* fcntl() locks */
+#endif
+
+typedef struct SHM_ENTRY_STRUCTURE {
+    time_t expire;                                 /* 0 for an empty entry */
+    unsigned int key_len, val_len;
+    unsigned char key[SSL_MAX_SSL_SESSION_ID_LENGTH];
+    unsigned char val[SHM_CACHE_VAL_LEN];              /* encoded session */
+} SHM_ENTRY;
+
+typedef struct SHM_CACHE_STRUCTURE {
+    unsigned int magic, entry_size, stripe_size;    /* entries per stripe */
+#if defined(USE_PTHREAD) || defined(USE_EPOLL)
+    pthread_mutex_t mutex[SHM_CACHE_STRIPES];
+#endif
+    SHM_ENTRY entries[1];       /* SHM_CACHE_STRIPES*stripe_size entries */
+} SHM_CACHE;
+
+/* connections of a previous configuration may still use its mapping, */
+/* so a mapping is never unmapped, and reloads reuse it instead */
+typedef struct SHM_MAP_STRUCTURE {
+    struct SHM_MAP_STRUCTURE *next;
+    dev_t dev;
+    ino_t ino;
+    size_t size;
+    SHM_CACHE *cache;
+    int fd;
+} SHM_MAP;
+
+static SHM_MAP *shm_maps=NULL;
+
+NOEXPORT int shm_cache_init(SERVICE_OPTIONS *section) {
+    SHM_CACHE *cache;
+    SHM_MAP *map;
+    unsigned int stripe_size;
+    size_t size;
+    struct stat st;
+    struct flock lock;
+    int fd, flags;
+#if defined(USE_PTHREAD) || defined(USE_EPOLL)
+    pthread_mutexattr_t attr;
+    unsigned int i;
+#endif
+
+    stripe_size=(unsigned int)((section->session_size+SHM_CACHE_STRIPES-1)/
+        SHM_CACHE_STRIPES);
+    size=sizeof(SHM_CACHE)+
+        (SHM_CACHE_STRIPES*stripe_size-1)*sizeof(SHM_ENTRY);
+
+    flags=O_RDWR|O_CREAT;
+#ifdef O_CLOEXEC
+    flags|=O_CLOEXEC;
+#endif /* O_CLOEXEC */
+    fd=open(section->session_shm, flags, 0600);
+    if(fd<0) {
+        ioerror(section->session_shm);
+        return 1; /* FAILED */
+    }
+
+    /* serialize the initialization with other processes */
+    memset(&lock, 0, sizeof lock);
+    lock.l_type=F_WRLCK;
+    lock.l_whence=SEEK_SET;
+    if(fcntl(fd, F_SETLKW, &lock)<0 || fstat(fd, &st)<0) {
+        ioerror(section->session_shm);
+        close(fd);
+        return 1; /* FAILED */
+    }
+    for(map=shm_maps; map; map=map->next)
+        if(map->dev==st.st_dev && map->ino==st.st_ino && map->size==size) {
+            close(fd); /* also releases the lock */
+            section->shm_cache=map->cache;
+            section->shm_fd=map->fd;
+            s_log(LOG_INFO, "Shared memory session cache: %s (mapping reused)",
+                section->session_shm);
+            return 0; /* OK */
+        }
+    if(st.st_size && (size_t)st.st_size!=size) {
+        s_log(LOG_ERR, "%s: sessionCacheSize does not match the existing cache",
+            section->session_shm);
+        close(fd); /* also releases the lock */
+        return 1; /* FAILED */
+    }
+    if(!st.st_size && ftruncate(fd, (off_t)size)<0) {
+        ioerror("shm_cache_init: ftruncate");
+        close(fd);
+        return 1; /* FAILED */
+    }
+    cache=mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if(cache==MAP_FAILED) {
+        ioerror("shm_cache_init: mmap");
+        close(fd);
+        return 1; /* FAILED */
+    }
+    if(!st.st_size) { /* a new (zero-filled) cache */
+        cache->entry_size=sizeof(SHM_ENTRY);
+        cache->stripe_size=stripe_size;
+#if defined(USE_PTHREAD) || defined(USE_EPOLL)
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#ifdef __GLIBC__
+        /* recover the locks of processes killed in a critical section */
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+        for(i=0; i<SHM_CACHE_STRIPES; i++)
+            pthread_mutex_init(cache->mutex+i, &attr);
+        pthread_mutexattr_destroy(&attr);
+#endif
+        cache->magic=SHM_CACHE_MAGIC;
+    } else if(cache->magic!=SHM_CACHE_MAGIC ||
+            cache->entry_size!=sizeof(SHM_ENTRY) ||
+            cache->stripe_size!=stripe_size) {
+        s_log(LOG_ERR, "%s: Incompatible session cache file",
+            section->session_shm);
+        munmap((void *)cache, size);
+        close(fd);
+        return 1; /* FAILED */
+    }
+    lock.l_type=F_UNLCK;
+    fcntl(fd, F_SETLK, &lock);
+
+    map=str_alloc(sizeof(SHM_MAP));
+    str_detach(map); /* used until the process exits */
+    map->dev=st.st_dev;
+    map->ino=st.st_ino;
+    map->size=size;
+    map->cache=cache;
+    map->fd=fd;
+    map->next=shm_maps;
+    shm_maps=map;
+
+    section->shm_cache=cache;
+    section->shm_fd=fd;
+    s_log(LOG_INFO, "Shared memory session cache: %s (%u entries)",
+        section->session_shm, SHM_CACHE_STRIPES*stripe_size);
+    return 0; /* OK */
+}
+
+NOEXPORT void shm_cache_new(SERVICE_OPTIONS *section,
+        const unsigned int timeout,
+        const unsigned char *key, const unsigned int key_len,
+        const unsigned char *val, const unsigned int val_len) {
+    SHM_ENTRY *entry;
+    unsigned int hash;
+
+    if(key_len>SSL_MAX_SSL_SESSION_ID_LENGTH || val_len>SHM_CACHE_VAL_LEN) {
+        s_log(LOG_DEBUG, "shm_cache_new: session too big (%u bytes)",
+            val_len);
+        return;
+    }
+    hash=shm_cache_hash(key, key_len);
+    if(shm_cache_lock(section, hash))
+        return;
+    entry=shm_cache_find(section, key, key_len, 1);
+    entry->expire=time(NULL)+timeout;
+    entry->key_len=key_len;
+    memcpy(entry->key, key, key_len);
+    entry->val_len=val_len;
+    memcpy(entry->val, val, val_len);
+    shm_cache_unlock(section, hash);
+}
+
+NOEXPORT void shm_cache_get(SERVICE_OPTIONS *section,
+        const unsigned char *key, const unsigned int key_len,
+        unsigned char **ret, unsigned int *ret_len) {
+    SHM_ENTRY *entry;
+    unsigned int hash;
+
+    *ret=NULL;
+    hash=shm_cache_hash(key, key_len);
+    if(shm_cache_lock(section, hash))
+        return;
+    entry=shm_cache_find(section, key, key_len, 0);
+    if(entry) {
+        *ret_len=entry->val_len;
+        *ret=str_alloc(*ret_len);
+        memcpy(*ret, entry->val, *ret_len);
+    }
+    shm_cache_unlock(section, hash);
+    s_log(LOG_DEBUG, "shm_cache_get: session %s", *ret ? "found" : "not found");
+}
+
+NOEXPORT void shm_cache_remove(SERVICE_OPTIONS *section,
+        const unsigned char *key, const unsigned int key_len) {
+    SHM_ENTRY *entry;
+    unsigned int hash;
+
+    hash=shm_cache_hash(key, key_len);
+    if(shm_cache_lock(section, hash))
+        return;
+    entry=shm_cache_find(section, key, key_len, 0);
+    if(entry)
+        entry->expire=0;
+    shm_cache_unlock(section, hash);
+}
+
+/* find the entry of a session, or the entry to be replaced if insert */
+NOEXPORT SHM_ENTRY *shm_cache_find(SERVICE_OPTIONS *section,
+        const unsigned char *key, const unsigned int key_len, int insert) {
+    SHM_CACHE *cache=section->shm_cache;
+    SHM_ENTRY *stripe, *entry, *victim=NULL;
+    unsigned int hash, i, probes;
+    time_t now;
+
+    if(key_len>SSL_MAX_SSL_SESSION_ID_LENGTH)
+        return NULL;
+    hash=shm_cache_hash(key, key_len);
+    stripe=cache->entries+(hash%SHM_CACHE_STRIPES)*cache->stripe_size;
+    hash/=SHM_CACHE_STRIPES;
+    probes=cache->stripe_size<SHM_CACHE_PROBES ?
+        cache->stripe_size : SHM_CACHE_PROBES;
+    now=time(NULL);
+    for(i=0; i<probes; i++) {
+        entry=stripe+(hash+i)%cache->stripe_size;
+        if(entry->expire && entry->expire<=now)
+            entry->expire=0; /* expired */
+        if(entry->expire && entry->key_len==key_len &&
+                !memcmp(entry->key, key, key_len))
+            return entry;
+        /* replace an empty entry, or the one expiring first */
+        if(!victim || (victim->expire && entry->expire<victim->expire))
+            victim=entry;
+    }
+    return insert ? victim : NULL;
+}
+
+/* FNV-1a hash of the session id */
+NOEXPORT unsigned int shm_cache_hash(const unsigned char *key,
+        const unsigned int key_len) {
+    unsigned int hash=2166136261u, i;
+
+    for(i=0; i<key_len; i++)
+        hash=(hash^key[i])*16777619u;
+    return hash;
+}
+
+NOEXPORT int shm_cache_lock(SERVICE_OPTIONS *section, unsigned int hash) {
+    unsigned int stripe=hash%SHM_CACHE_STRIPES;
+#if defined(USE_PTHREAD) || defined(USE_EPOLL)
+    SHM_CACHE *cache=section->shm_cache;
+    int error;
+
+    error=pthread_mutex_lock(cache->mutex+stripe);
+#ifdef __GLIBC__
+    if(error==EOWNERDEAD) { /* the entries may be inconsistent */
+        memset(cache->entries+stripe*cache->stripe_size, 0,
+            cache->stripe_size*sizeof(SHM_ENTRY));
+        pthread_mutex_consistent(cache->mutex+stripe);
+        error=0;
+    }
+#endif
+    if(error) {
+        errno=error;
+        ioerror("shm_cache_lock: pthread_mutex_lock");
+        return 1;
+    }
+#else
+    struct flock lock;
+
+    /* one byte of the file for each stripe */
+    memset(&lock, 0, sizeof lock);
+    lock.l_type=F_WRLCK;
+    lock.l_whence=SEEK_SET;
+    lock.l_start=stripe;
+    lock.l_len=1;
+    while(fcntl(section->shm_fd, F_SETLKW, &lock)<0) {
+        if(errno!=EINTR) {
+            ioerror("shm_cache_lock: fcntl");
+            return 1;
+        }
+    }
+#endif
+    return 0;
+}
+
+NOEXPORT void shm_cache_unlock(SERVICE_OPTIONS *section, unsigned int hash) {
+    unsigned int stripe=hash%SHM_CACHE_STRIPES;
+#if defined(USE_PTHREAD) || defined(USE_EPOLL)
+    pthread_mutex_unlock(section->shm_cache->mutex+stripe);
+#else
+    struct flock lock;
+
+    memset(&lock, 0, sizeof lock);
+    lock.l_type=F_UNLCK;
+    lock.l_whence=SEEK_SET;
+    lock.l_start=stripe;
+    lock.l_len=1;
+    fcntl(section->shm_fd, F_SETLK, &lock);
+#endif
+}
+
+#endif /* !USE_WIN32 */
+
 /**************************************** informational callback */
 
 NOEXPORT void info_callback(
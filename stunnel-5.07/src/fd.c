@@ -192,7 +192,15 @@ NOEXPORT int setup_fd(int fd, int nonblock, char *msg) {
 #endif
 
     if(fd<0) {
-        sockerror(msg);
+        switch(get_last_socket_error()) {
+        case S_EWOULDBLOCK: /* e.g. a drained accept queue */
+#if S_EAGAIN!=S_EWOULDBLOCK
+        case S_EAGAIN:
+#endif
+            break; /* not an error to report */
+        default:
+            sockerror(msg);
+        }
         return -1;
     }
 #ifndef USE_FORK
@@ -46,6 +46,17 @@
 /* #define DEBUG_UCONTEXT */
 
 NOEXPORT void s_poll_realloc(s_poll_set *);
+NOEXPORT int s_poll_find(s_poll_set *, int);
+#if defined(USE_UCONTEXT_EPOLL) || defined(USE_EPOLL)
+NOEXPORT void s_poll_bind(s_poll_set *, CONTEXT *);
+NOEXPORT void s_poll_register(s_poll_set *, CONTEXT *);
+NOEXPORT void s_poll_release(s_poll_set *);
+NOEXPORT void slot_unregister(s_poll_set *, unsigned int);
+NOEXPORT int context_epfd(CONTEXT *);
+#endif /* USE_UCONTEXT_EPOLL || USE_EPOLL */
+#ifdef USE_IO_URING
+NOEXPORT void uring_remove(REACTOR *, EPOLL_SLOT *);
+#endif /* USE_IO_URING */
 NOEXPORT int get_socket_error(const int);
 
 /**************************************** s_poll functions */
@@ -59,100 +70,460 @@ s_poll_set *s_poll_alloc() {
 
 void s_poll_free(s_poll_set *fds) {
     if(fds) {
+#if defined(USE_UCONTEXT_EPOLL) || defined(USE_EPOLL)
+        s_poll_release(fds);
+        if(fds->slots)
+            str_free(fds->slots);
+#endif
         if(fds->ufds)
             str_free(fds->ufds);
+        if(fds->fd)
+            str_free(fds->fd);
         str_free(fds);
     }
 }
 
 void s_poll_init(s_poll_set *fds) {
+#if defined(USE_UCONTEXT_EPOLL) || defined(USE_EPOLL)
+    s_poll_release(fds); /* all slots are released */
+#endif
     fds->nfds=0;
-    fds->allocated=4; /* prealloc 4 file desciptors */
-    s_poll_realloc(fds);
+    if(!fds->ufds) { /* keep the memory allocated by previous calls */
+        fds->allocated=4; /* prealloc 4 file desciptors */
+        s_poll_realloc(fds);
+    }
 }
 
 void s_poll_add(s_poll_set *fds, int fd, int rd, int wr) {
+    s_poll_want(fds, s_poll_slot(fds, fd), rd, wr);
+}
+
+/* register a file descriptor once and return its stable slot number */
+int s_poll_slot(s_poll_set *fds, int fd) {
     unsigned int i;
 
-    for(i=0; i<fds->nfds && fds->ufds[i].fd!=fd; i++)
+    for(i=0; i<fds->nfds && fds->fd[i]!=fd; i++)
         ;
     if(i==fds->nfds) {
         if(i==fds->allocated) {
             fds->allocated=i+1;
             s_poll_realloc(fds);
         }
-        fds->ufds[i].fd=fd;
+        fds->fd[i]=fd;
+        fds->ufds[i].fd=-1; /* ignored by poll() until s_poll_want() */
         fds->ufds[i].events=0;
+        fds->ufds[i].revents=0;
+#if defined(USE_UCONTEXT_EPOLL) || defined(USE_EPOLL)
+        fds->slots[i].fds=fds;
+        fds->slots[i].index=i;
+        fds->slots[i].registered=0; /* registered by s_poll_wait() */
+#ifdef USE_IO_URING
+        fds->slots[i].request=-1;
+#endif
+#endif
         fds->nfds++;
     }
+    return (int)i;
+}
+
+/* clear the interest of all slots without releasing them */
+void s_poll_reset(s_poll_set *fds) {
+    unsigned int i;
+
+    for(i=0; i<fds->nfds; i++) {
+        fds->ufds[i].fd=-1;
+        fds->ufds[i].events=0;
+        fds->ufds[i].revents=0;
+    }
+}
+
+/* poll the slot (for errors and hangups) and add the requested interest */
+void s_poll_want(s_poll_set *fds, int slot, int rd, int wr) {
+    struct pollfd *ufd=fds->ufds+slot;
+
+    ufd->fd=fds->fd[slot];
     if(rd) {
-        fds->ufds[i].events|=POLLIN;
+        ufd->events|=POLLIN;
 #ifdef POLLRDHUP
-        fds->ufds[i].events|=POLLRDHUP;
+        ufd->events|=POLLRDHUP;
 #endif
     }
     if(wr)
-        fds->ufds[i].events|=POLLOUT;
+        ufd->events|=POLLOUT;
 }
 
-int s_poll_canread(s_poll_set *fds, int fd) {
-    unsigned int i;
+int s_poll_slot_canread(s_poll_set *fds, int slot) {
+    return fds->ufds[slot].revents&POLLIN;
+}
 
-    for(i=0; i<fds->nfds; i++)
-        if(fds->ufds[i].fd==fd)
-            return fds->ufds[i].revents&POLLIN;
-    return 0; /* not listed in fds */
+int s_poll_slot_canwrite(s_poll_set *fds, int slot) {
+    return fds->ufds[slot].revents&POLLOUT;
 }
 
-int s_poll_canwrite(s_poll_set *fds, int fd) {
-    unsigned int i;
+/* best doc: http://lxr.free-electrons.com/source/net/ipv4/tcp.c#L456 */
 
-    for(i=0; i<fds->nfds; i++)
-        if(fds->ufds[i].fd==fd)
-            return fds->ufds[i].revents&POLLOUT;
-    return 0; /* not listed in fds */
+int s_poll_slot_hup(s_poll_set *fds, int slot) {
+    return fds->ufds[slot].revents&POLLHUP; /* read and write closed */
 }
 
-/* best doc: http://lxr.free-electrons.com/source/net/ipv4/tcp.c#L456 */
+int s_poll_slot_rdhup(s_poll_set *fds, int slot) {
+#ifdef POLLRDHUP
+    return fds->ufds[slot].revents&POLLRDHUP; /* read closed */
+#else
+    return fds->ufds[slot].revents&POLLHUP; /* read and write closed */
+#endif
+}
 
-int s_poll_hup(s_poll_set *fds, int fd) {
+int s_poll_slot_error(s_poll_set *fds, int slot) {
+    return fds->ufds[slot].revents&(POLLERR|POLLNVAL) ?
+        get_socket_error(fds->fd[slot]) : 0;
+}
+
+/* slot of a polled file descriptor or -1 */
+NOEXPORT int s_poll_find(s_poll_set *fds, int fd) {
     unsigned int i;
 
     for(i=0; i<fds->nfds; i++)
         if(fds->ufds[i].fd==fd)
-            return fds->ufds[i].revents&POLLHUP; /* read and write closed */
-    return 0; /* not listed in fds */
+            return (int)i;
+    return -1; /* not listed in fds */
 }
 
-int s_poll_rdhup(s_poll_set *fds, int fd) {
+NOEXPORT void s_poll_realloc(s_poll_set *fds) {
+#if defined(USE_UCONTEXT_EPOLL) || defined(USE_EPOLL)
+    s_poll_release(fds); /* registrations point to the old slots */
+    fds->slots=str_realloc(fds->slots, fds->allocated*sizeof(EPOLL_SLOT));
+#endif
+    fds->ufds=str_realloc(fds->ufds, fds->allocated*sizeof(struct pollfd));
+    fds->fd=str_realloc(fds->fd, fds->allocated*sizeof(int));
+}
+
+#if defined(USE_UCONTEXT_EPOLL) || defined(USE_EPOLL)
+
+/* milliseconds left until the deadline (rounded up) */
+NOEXPORT int deadline_ms(struct timespec *finish, struct timespec *now) {
+    long sec, nsec;
+
+    sec=finish->tv_sec-now->tv_sec;
+    nsec=finish->tv_nsec-now->tv_nsec;
+    if(sec<0 || (sec==0 && nsec<=0))
+        return 0; /* expired */
+    return (int)(sec*1000+(nsec+999999)/1000000);
+}
+
+NOEXPORT void deadline_set(struct timespec *finish, int sec, int msec) {
+    clock_gettime(CLOCK_MONOTONIC, finish);
+    finish->tv_sec+=sec+msec/1000;
+    finish->tv_nsec+=(msec%1000)*1000000L;
+    if(finish->tv_nsec>=1000000000L) {
+        finish->tv_sec++;
+        finish->tv_nsec-=1000000000L;
+    }
+}
+
+/* the timer heap keeps the nearest deadline at contexts[0] */
+
+NOEXPORT int timer_before(CONTEXT *a, CONTEXT *b) {
+    return a->finish.tv_sec<b->finish.tv_sec ||
+        (a->finish.tv_sec==b->finish.tv_sec &&
+        a->finish.tv_nsec<b->finish.tv_nsec);
+}
+
+NOEXPORT void timer_set(TIMER_HEAP *heap, unsigned int i, CONTEXT *context) {
+    heap->contexts[i]=context;
+    context->timer=i+1;
+}
+
+/* move the context at position i to restore the heap order */
+NOEXPORT void timer_sift(TIMER_HEAP *heap, unsigned int i) {
+    CONTEXT *context=heap->contexts[i];
+    unsigned int parent, child;
+
+    while(i>0) { /* move up */
+        parent=(i-1)/2;
+        if(!timer_before(context, heap->contexts[parent]))
+            break;
+        timer_set(heap, i, heap->contexts[parent]);
+        i=parent;
+    }
+    for(;;) { /* move down */
+        child=2*i+1;
+        if(child>=heap->count)
+            break;
+        if(child+1<heap->count &&
+                timer_before(heap->contexts[child+1], heap->contexts[child]))
+            child++;
+        if(!timer_before(heap->contexts[child], context))
+            break;
+        timer_set(heap, i, heap->contexts[child]);
+        i=child;
+    }
+    timer_set(heap, i, context);
+}
+
+NOEXPORT void timer_add(TIMER_HEAP *heap, CONTEXT *context) {
+    if(heap->count==heap->allocated) {
+        heap->allocated=heap->allocated ? 2*heap->allocated : 64;
+        heap->contexts=str_realloc(heap->contexts,
+            heap->allocated*sizeof(CONTEXT *));
+        str_detach(heap->contexts); /* shared by all contexts */
+    }
+    heap->contexts[heap->count++]=context;
+    timer_sift(heap, heap->count-1);
+}
+
+NOEXPORT void timer_remove(TIMER_HEAP *heap, CONTEXT *context) {
+    unsigned int i=context->timer-1;
+
+    context->timer=0;
+    if(i<--heap->count) { /* fill the gap with the last element */
+        heap->contexts[i]=heap->contexts[heap->count];
+        timer_sift(heap, i);
+    }
+}
+
+/* return the first expired context or NULL */
+NOEXPORT CONTEXT *timer_expired(TIMER_HEAP *heap, struct timespec *now) {
+    CONTEXT *context;
+
+    if(!heap->count || deadline_ms(&heap->contexts[0]->finish, now))
+        return NULL;
+    context=heap->contexts[0];
+    timer_remove(heap, context);
+    return context;
+}
+
+/* milliseconds until the nearest deadline or -1 */
+NOEXPORT int timer_timeout(TIMER_HEAP *heap) {
+    struct timespec now;
+
+    if(!heap->count)
+        return -1;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return deadline_ms(&heap->contexts[0]->finish, &now);
+}
+
+/* slots stay registered while their context keeps waiting on the same set */
+/* only changed interest is updated with EPOLL_CTL_MOD */
+
+/* make the set the only one registered for the context */
+NOEXPORT void s_poll_bind(s_poll_set *fds, CONTEXT *context) {
+    if(context->fds!=fds) { /* the context waited on another set */
+        if(context->fds)
+            s_poll_release(context->fds);
+        if(fds->context)
+            s_poll_release(fds);
+        context->fds=fds;
+    }
+    fds->context=context;
+    context->ready=0;
+}
+
+NOEXPORT void s_poll_register(s_poll_set *fds, CONTEXT *context) {
+    EPOLL_SLOT *slot;
+    struct epoll_event event;
     unsigned int i;
 
-    for(i=0; i<fds->nfds; i++)
-        if(fds->ufds[i].fd==fd)
-#ifdef POLLRDHUP
-            return fds->ufds[i].revents&POLLRDHUP; /* read closed */
-#else
-            return fds->ufds[i].revents&POLLHUP; /* read and write closed */
-#endif
-    return 0; /* not listed in fds */
+    s_poll_bind(fds, context);
+    for(i=0; i<fds->nfds; i++) {
+        slot=fds->slots+i;
+        fds->ufds[i].revents=0;
+        if(fds->ufds[i].fd<0) { /* slot disabled with s_poll_reset() */
+            if(slot->registered) /* errors and hangups are not polled */
+                slot_unregister(fds, i);
+            continue;
+        }
+        if(slot->registered && slot->events==fds->ufds[i].events)
+            continue; /* no change */
+        memset(&event, 0, sizeof event);
+        event.events=(unsigned short)fds->ufds[i].events;
+        event.data.ptr=slot;
+        if(epoll_ctl(context_epfd(context),
+                slot->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+                fds->fd[i], &event)) {
+            /* e.g. regular files are not supported: report as ready */
+            slot->registered=0;
+            fds->ufds[i].revents=fds->ufds[i].events;
+            context->ready++;
+            continue;
+        }
+        slot->registered=1;
+        slot->events=fds->ufds[i].events;
+    }
 }
 
-int s_poll_error(s_poll_set *fds, int fd) {
+/* unregister all slots, e.g. before they are released */
+NOEXPORT void s_poll_release(s_poll_set *fds) {
     unsigned int i;
 
+    if(!fds->context) /* nothing registered */
+        return;
     for(i=0; i<fds->nfds; i++)
-        if(fds->ufds[i].fd==fd)
-            return fds->ufds[i].revents&(POLLERR|POLLNVAL) ?
-                get_socket_error(fd) : 0;
-    return 0; /* not listed in fds */
+        if(fds->slots[i].registered)
+            slot_unregister(fds, i);
+    if(fds->context->fds==fds)
+        fds->context->fds=NULL;
+    fds->context=NULL;
 }
 
-NOEXPORT void s_poll_realloc(s_poll_set *fds) {
-    fds->ufds=str_realloc(fds->ufds, fds->allocated*sizeof(struct pollfd));
+NOEXPORT void slot_unregister(s_poll_set *fds, unsigned int i) {
+    struct epoll_event event; /* needed by kernels older than 2.6.9 */
+
+#ifdef USE_IO_URING
+    if(fds->context->reactor->uring) {
+        uring_remove(fds->context->reactor, fds->slots+i);
+        return;
+    }
+#endif /* USE_IO_URING */
+    memset(&event, 0, sizeof event);
+    epoll_ctl(context_epfd(fds->context), EPOLL_CTL_DEL, fds->fd[i], &event);
+    fds->slots[i].registered=0;
 }
 
+#endif /* USE_UCONTEXT_EPOLL || USE_EPOLL */
+
 #ifdef USE_UCONTEXT
 
+#ifdef USE_UCONTEXT_EPOLL
+
+#define SCHEDULER_EVENTS 64
+
+static int epfd=-1; /* descriptors of all waiting contexts */
+static TIMER_HEAP timers; /* waiting contexts with a finite timeout */
+
+NOEXPORT int context_epfd(CONTEXT *context) {
+    (void)context; /* skip warning about unused parameter */
+    return epfd; /* shared by all contexts */
+}
+
+NOEXPORT void ready_append(CONTEXT *context) {
+    context->next=NULL;
+    if(ready_tail)
+        ready_tail->next=context;
+    ready_tail=context;
+    if(!ready_head)
+        ready_head=context;
+}
+
+/* move ready contexts from epoll and the timer heap to ready queue */
+NOEXPORT void scan_waiting_queue(void) {
+    CONTEXT *context;
+    EPOLL_SLOT *slot;
+    struct epoll_event events[SCHEDULER_EVENTS];
+    struct timespec now;
+    int timeout, n, i;
+
+    timeout=timer_timeout(&timers);
+#ifdef DEBUG_UCONTEXT
+    s_log(LOG_DEBUG, "Waiting %d millisecond(s)", timeout);
+#endif
+    do { /* skip "Interrupted system call" errors */
+        n=epoll_wait(epfd, events, SCHEDULER_EVENTS, timeout);
+    } while(n<0 && get_last_socket_error()==S_EINTR);
+    if(n<0) {
+        ioerror("epoll_wait");
+        n=0;
+    }
+
+    /* process the returned events */
+    for(i=0; i<n; i++) {
+        slot=events[i].data.ptr;
+        context=slot->fds->context;
+        /* EPOLL* and POLL* flags have the same values on Linux */
+        slot->fds->ufds[slot->index].revents=(short)events[i].events;
+#ifdef DEBUG_UCONTEXT
+        s_log(LOG_DEBUG, "CONTEXT %ld, FD=%d, revents=0x%x",
+            context->id, slot->fds->fd[slot->index], events[i].events);
+#endif
+        if(!context->ready++) {
+            if(context->timer)
+                timer_remove(&timers, context);
+            ready_append(context);
+        }
+    }
+
+    /* expire timeouts */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    while((context=timer_expired(&timers, &now)))
+        ready_append(context);
+}
+
+int s_poll_wait(s_poll_set *fds, int sec, int msec) {
+    CONTEXT *context; /* current context */
+    static CONTEXT *to_free=NULL; /* delayed memory deallocation */
+
+    if(epfd<0) { /* the first call */
+        epfd=epoll_create(SCHEDULER_EVENTS);
+        if(epfd<0) {
+            ioerror("epoll_create");
+            return -1;
+        }
+#ifdef FD_CLOEXEC
+        fcntl(epfd, F_SETFD, FD_CLOEXEC);
+#endif
+    }
+
+    /* remove the current context from ready queue */
+    context=ready_head;
+    ready_head=ready_head->next;
+    if(!ready_head) /* the queue is empty */
+        ready_tail=NULL;
+    /* it it safe to s_log() after new ready_head is set */
+
+    /* it's illegal to deallocate the stack of the current context */
+    if(to_free) { /* a delayed deallocation is scheduled */
+#ifdef DEBUG_UCONTEXT
+        s_log(LOG_DEBUG, "Releasing context %ld", to_free->id);
+#endif
+        str_free(to_free->stack);
+        str_free(to_free);
+        to_free=NULL;
+    }
+
+    /* manage the current thread */
+    if(fds) { /* something to wait for -> swap the context */
+        s_poll_register(fds, context); /* set file descriptors to wait for */
+        if(context->ready) { /* no need to wait */
+            ready_append(context);
+        } else if(sec>=0) { /* finite time */
+            deadline_set(&context->finish, sec, msec);
+            timer_add(&timers, context);
+        }
+    } else { /* nothing to wait for -> drop the context */
+        if(context->fds) /* not released with s_poll_free() */
+            s_poll_release(context->fds);
+        to_free=context; /* schedule for delayed deallocation */
+    }
+
+    while(!ready_head) /* wait until there is a thread to switch to */
+        scan_waiting_queue();
+
+    /* switch threads */
+    if(fds) { /* swap the current context */
+        if(context->id!=ready_head->id) {
+#ifdef DEBUG_UCONTEXT
+            s_log(LOG_DEBUG, "Context swap: %ld -> %ld",
+                context->id, ready_head->id);
+#endif
+            swapcontext(&context->context, &ready_head->context);
+#ifdef DEBUG_UCONTEXT
+            s_log(LOG_DEBUG, "Current context: %ld", ready_head->id);
+#endif
+        }
+        return ready_head->ready;
+    } else { /* drop the current context */
+#ifdef DEBUG_UCONTEXT
+        s_log(LOG_DEBUG, "Context set: %ld (dropped) -> %ld",
+            context->id, ready_head->id);
+#endif
+        setcontext(&ready_head->context);
+        ioerror("setcontext"); /* should not ever happen */
+        return 0;
+    }
+}
+
+#else /* USE_UCONTEXT_EPOLL */
+
 /* move ready contexts from waiting queue to ready queue */
 NOEXPORT void scan_waiting_queue(void) {
     int retval;
@@ -308,7 +679,581 @@ int s_poll_wait(s_poll_set *fds, int sec, int msec) {
     }
 }
 
-#else /* USE_UCONTEXT */
+#endif /* USE_UCONTEXT_EPOLL */
+
+#elif defined(USE_EPOLL)
+
+#define REACTOR_EVENTS 64
+
+NOEXPORT void ready_append(REACTOR *, CONTEXT *);
+NOEXPORT void epoll_wait_events(REACTOR *, int);
+#ifdef USE_IO_URING
+NOEXPORT int uring_init(REACTOR *);
+NOEXPORT struct io_uring_sqe *uring_sqe(URING *);
+NOEXPORT struct io_uring_sqe *uring_get_sqe(REACTOR *);
+NOEXPORT void uring_queue(URING *);
+NOEXPORT int uring_submit(URING *, unsigned int, unsigned int);
+NOEXPORT int uring_poll_add(REACTOR *, int, short, __u64);
+NOEXPORT int uring_request_new(URING *);
+NOEXPORT void uring_request_free(URING *, int);
+NOEXPORT void uring_register(REACTOR *, s_poll_set *);
+NOEXPORT int uring_cancel(REACTOR *, int);
+NOEXPORT void uring_retry(REACTOR *);
+NOEXPORT void uring_wait_events(REACTOR *, int);
+NOEXPORT void uring_completions(REACTOR *);
+#endif /* USE_IO_URING */
+
+int reactor_init(REACTOR *reactor) {
+    struct epoll_event event;
+
+    if(s_pipe(reactor->wakeup, 1, "reactor_init: s_pipe"))
+        return 1;
+#ifdef USE_IO_URING
+    if(global_options.option.io_uring) {
+        if(!uring_init(reactor))
+            return 0;
+        s_log(LOG_WARNING, "io_uring is not available: using epoll");
+    }
+#endif /* USE_IO_URING */
+#ifdef USE_NEW_LINUX_API
+    reactor->epfd=epoll_create1(EPOLL_CLOEXEC);
+#else
+    reactor->epfd=epoll_create(REACTOR_EVENTS);
+#endif
+    if(reactor->epfd<0) {
+        ioerror("epoll_create");
+        close(reactor->wakeup[0]);
+        close(reactor->wakeup[1]);
+        return 1;
+    }
+#if !defined(USE_NEW_LINUX_API) && defined(FD_CLOEXEC)
+    fcntl(reactor->epfd, F_SETFD, FD_CLOEXEC);
+#endif
+    memset(&event, 0, sizeof event);
+    event.events=EPOLLIN;
+    event.data.ptr=NULL; /* NULL indicates the wakeup pipe */
+    if(epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->wakeup[0], &event)) {
+        ioerror("epoll_ctl");
+        close(reactor->wakeup[0]);
+        close(reactor->wakeup[1]);
+        close(reactor->epfd);
+        return 1;
+    }
+    reactor->events=str_alloc(REACTOR_EVENTS*sizeof(struct epoll_event));
+    str_detach(reactor->events);
+    return 0;
+}
+
+NOEXPORT int context_epfd(CONTEXT *context) {
+    return context->reactor->epfd;
+}
+
+/* wait for events and move ready contexts to the ready queue */
+void reactor_wait(REACTOR *reactor) {
+    CONTEXT *context;
+    struct timespec now;
+    int timeout;
+
+    timeout=timer_timeout(&reactor->timers);
+#ifdef USE_IO_URING
+    if(reactor->uring)
+        uring_wait_events(reactor, timeout);
+    else
+#endif /* USE_IO_URING */
+        epoll_wait_events(reactor, timeout);
+
+    /* expire timeouts */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    while((context=timer_expired(&reactor->timers, &now)))
+        ready_append(reactor, context);
+}
+
+NOEXPORT void epoll_wait_events(REACTOR *reactor, int timeout) {
+    CONTEXT *context;
+    EPOLL_SLOT *slot;
+    int n, i;
+    char buffer[64];
+
+    do { /* skip "Interrupted system call" errors */
+        n=epoll_wait(reactor->epfd, reactor->events, REACTOR_EVENTS, timeout);
+    } while(n<0 && get_last_socket_error()==S_EINTR);
+    if(n<0) {
+        ioerror("epoll_wait");
+        return;
+    }
+
+    /* process the returned events */
+    for(i=0; i<n; i++) {
+        slot=reactor->events[i].data.ptr;
+        if(!slot) { /* new contexts are queued in the inbox */
+            while(read(reactor->wakeup[0], buffer, sizeof buffer)>0)
+                ;
+            continue;
+        }
+        context=slot->fds->context;
+        /* EPOLL* and POLL* flags have the same values on Linux */
+        slot->fds->ufds[slot->index].revents=
+            (short)reactor->events[i].events;
+        if(!context->ready++) {
+            if(context->timer)
+                timer_remove(&reactor->timers, context);
+            ready_append(reactor, context);
+        }
+    }
+}
+
+int s_poll_wait(s_poll_set *fds, int sec, int msec) {
+    CONTEXT *context; /* current context */
+    REACTOR *reactor;
+    int retval;
+
+    context=current_context();
+    if(!context) { /* not running on a reactor thread (e.g. inetd mode) */
+        do { /* skip "Interrupted system call" errors */
+            retval=poll(fds->ufds, fds->nfds, sec<0 ? -1 : 1000*sec+msec);
+        } while(retval<0 && get_last_socket_error()==S_EINTR);
+        return retval;
+    }
+    reactor=context->reactor;
+
+    if(!fds) { /* nothing to wait for -> drop the context */
+        if(context->fds) /* not released with s_poll_free() */
+            s_poll_release(context->fds);
+        reactor->to_free=context; /* schedule for delayed deallocation */
+        setcontext(&reactor->scheduler);
+        ioerror("setcontext"); /* should not ever happen */
+        return 0;
+    }
+
+    /* register file descriptors with the reactor */
+#ifdef USE_IO_URING
+    if(reactor->uring) {
+        uring_register(reactor, fds);
+    } else
+#endif /* USE_IO_URING */
+        s_poll_register(fds, context);
+
+    if(context->ready) { /* no need to wait */
+        ready_append(reactor, context);
+    } else if(sec>=0) { /* finite time */
+        deadline_set(&context->finish, sec, msec);
+        timer_add(&reactor->timers, context);
+    }
+
+    /* switch to the reactor loop until the context is ready */
+    swapcontext(&context->context, &reactor->scheduler);
+    return context->ready;
+}
+
+#ifdef USE_IO_URING
+
+/* poll requests are submitted in batches with a single io_uring_enter() */
+/* call per reactor loop iteration, instead of an epoll_ctl() call for each */
+/* changed registration; socket reads and writes still use system calls */
+
+/* a poll request stays queued in the kernel until it completes or its slot */
+/* changes interest, so unchanged slots are not submitted again */
+
+#define URING_ENTRIES 256
+#define URING_WAKEUP ((__u64)-1)
+#define URING_TIMEOUT ((__u64)-2)
+#define URING_REMOVE ((__u64)-3)
+
+typedef struct {
+    s_poll_set *fds; /* NULL for a request being removed */
+    unsigned int index; /* index of the slot in fds */
+    int next_free; /* next unused request */
+} URING_REQUEST;
+
+struct URING_STRUCTURE {
+    int fd;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned int sq_entries, to_submit;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    URING_REQUEST *requests; /* poll requests owned by the kernel */
+    int allocated_requests, free_request;
+    int *cancels; /* requests waiting for a free submission entry */
+    int num_cancels, allocated_cancels;
+    int wakeup_armed; /* the wakeup pipe is polled */
+    struct __kernel_timespec timeout;
+};
+
+NOEXPORT int uring_init(REACTOR *reactor) {
+    struct io_uring_params params;
+    URING *uring;
+    int fd;
+
+    memset(&params, 0, sizeof params);
+    params.flags=IORING_SETUP_CQSIZE;
+    params.cq_entries=4*URING_ENTRIES; /* room for cancelled requests */
+    fd=(int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if(fd<0) {
+        ioerror("io_uring_setup");
+        return 1;
+    }
+    if(!(params.features&IORING_FEAT_NODROP)) {
+        s_log(LOG_ERR, "io_uring_setup: IORING_FEAT_NODROP not supported");
+        close(fd);
+        return 1;
+    }
+    uring=str_alloc(sizeof(URING));
+    str_detach(uring);
+    uring->fd=fd;
+    uring->sq_entries=params.sq_entries;
+    uring->sq_ring_size=params.sq_off.array+
+        params.sq_entries*sizeof(unsigned int);
+    uring->cq_ring_size=params.cq_off.cqes+
+        params.cq_entries*sizeof(struct io_uring_cqe);
+    if(params.features&IORING_FEAT_SINGLE_MMAP) {
+        if(uring->cq_ring_size>uring->sq_ring_size)
+            uring->sq_ring_size=uring->cq_ring_size;
+        uring->cq_ring_size=uring->sq_ring_size;
+    }
+    uring->sq_ring=mmap(NULL, uring->sq_ring_size, PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if(uring->sq_ring==MAP_FAILED) {
+        ioerror("mmap");
+        close(fd);
+        str_free(uring);
+        return 1;
+    }
+    if(params.features&IORING_FEAT_SINGLE_MMAP) {
+        uring->cq_ring=uring->sq_ring;
+    } else {
+        uring->cq_ring=mmap(NULL, uring->cq_ring_size, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if(uring->cq_ring==MAP_FAILED) {
+            ioerror("mmap");
+            munmap(uring->sq_ring, uring->sq_ring_size);
+            close(fd);
+            str_free(uring);
+            return 1;
+        }
+    }
+    uring->sqes=mmap(NULL, params.sq_entries*sizeof(struct io_uring_sqe),
+        PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(uring->sqes==MAP_FAILED) {
+        ioerror("mmap");
+        if(uring->cq_ring!=uring->sq_ring)
+            munmap(uring->cq_ring, uring->cq_ring_size);
+        munmap(uring->sq_ring, uring->sq_ring_size);
+        close(fd);
+        str_free(uring);
+        return 1;
+    }
+    uring->sq_head=(unsigned int *)((u8 *)uring->sq_ring+params.sq_off.head);
+    uring->sq_tail=(unsigned int *)((u8 *)uring->sq_ring+params.sq_off.tail);
+    uring->sq_mask=(unsigned int *)((u8 *)uring->sq_ring+params.sq_off.ring_mask);
+    uring->sq_array=(unsigned int *)((u8 *)uring->sq_ring+params.sq_off.array);
+    uring->cq_head=(unsigned int *)((u8 *)uring->cq_ring+params.cq_off.head);
+    uring->cq_tail=(unsigned int *)((u8 *)uring->cq_ring+params.cq_off.tail);
+    uring->cq_mask=(unsigned int *)((u8 *)uring->cq_ring+params.cq_off.ring_mask);
+    uring->cqes=(struct io_uring_cqe *)((u8 *)uring->cq_ring+params.cq_off.cqes);
+    uring->free_request=-1;
+    reactor->uring=uring;
+    reactor->epfd=-1;
+    uring->wakeup_armed=
+        !uring_poll_add(reactor, reactor->wakeup[0], POLLIN, URING_WAKEUP);
+    s_log(LOG_DEBUG, "io_uring initialized (FD=%d)", fd);
+    return 0;
+}
+
+/* get a free submission queue entry or NULL if the queue is full */
+NOEXPORT struct io_uring_sqe *uring_sqe(URING *uring) {
+    struct io_uring_sqe *sqe;
+    unsigned int tail, index;
+
+    tail=*uring->sq_tail;
+    if(tail-__atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE)>=
+            uring->sq_entries && /* submission queue is full */
+            (uring_submit(uring, 0, 0)<0 ||
+            tail-__atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE)>=
+            uring->sq_entries))
+        return NULL; /* e.g. EBUSY until the completion queue is reaped */
+    index=tail&*uring->sq_mask;
+    uring->sq_array[index]=index;
+    sqe=uring->sqes+index;
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    return sqe;
+}
+
+/* reap the completion queue if no submission queue entry is free */
+NOEXPORT struct io_uring_sqe *uring_get_sqe(REACTOR *reactor) {
+    struct io_uring_sqe *sqe;
+
+    sqe=uring_sqe(reactor->uring);
+    if(!sqe) {
+        uring_completions(reactor);
+        sqe=uring_sqe(reactor->uring);
+    }
+    return sqe;
+}
+
+/* make the queued entries visible to the kernel */
+NOEXPORT void uring_queue(URING *uring) {
+    __atomic_store_n(uring->sq_tail, *uring->sq_tail+1, __ATOMIC_RELEASE);
+    uring->to_submit++;
+}
+
+NOEXPORT int uring_submit(URING *uring, unsigned int min_complete,
+        unsigned int flags) {
+    int retval;
+
+    do { /* skip "Interrupted system call" errors */
+        retval=(int)syscall(__NR_io_uring_enter, uring->fd, uring->to_submit,
+            min_complete, flags, NULL, 0);
+    } while(retval<0 && get_last_socket_error()==S_EINTR);
+    if(retval<0) {
+        if(get_last_socket_error()!=EBUSY)
+            ioerror("io_uring_enter");
+        return -1;
+    }
+    uring->to_submit-=(unsigned int)retval;
+    return retval;
+}
+
+NOEXPORT int uring_poll_add(REACTOR *reactor, int fd, short events,
+        __u64 user_data) {
+    struct io_uring_sqe *sqe;
+
+    sqe=uring_get_sqe(reactor);
+    if(!sqe)
+        return 1;
+    sqe->opcode=IORING_OP_POLL_ADD;
+    sqe->fd=fd;
+    sqe->poll_events=(__u16)events;
+    sqe->user_data=user_data;
+    uring_queue(reactor->uring);
+    return 0;
+}
+
+NOEXPORT int uring_request_new(URING *uring) {
+    int n, id;
+
+    if(uring->free_request<0) { /* grow the request table */
+        n=uring->allocated_requests;
+        uring->allocated_requests=n ? 2*n : URING_ENTRIES;
+        uring->requests=str_realloc(uring->requests,
+            uring->allocated_requests*sizeof(URING_REQUEST));
+        str_detach(uring->requests);
+        while(n<uring->allocated_requests) {
+            uring->requests[n].next_free=uring->free_request;
+            uring->free_request=n++;
+        }
+    }
+    id=uring->free_request;
+    uring->free_request=uring->requests[id].next_free;
+    return id;
+}
+
+NOEXPORT void uring_request_free(URING *uring, int id) {
+    uring->requests[id].next_free=uring->free_request;
+    uring->free_request=id;
+}
+
+/* queue poll requests for enabled slots without a matching request */
+NOEXPORT void uring_register(REACTOR *reactor, s_poll_set *fds) {
+    URING *uring=reactor->uring;
+    EPOLL_SLOT *slot;
+    unsigned int i;
+
+    s_poll_bind(fds, reactor->current);
+    /* completions reaped by uring_get_sqe() are reported in this loop */
+    for(i=0; i<fds->nfds; i++)
+        fds->ufds[i].revents=0;
+    for(i=0; i<fds->nfds; i++) {
+        slot=fds->slots+i;
+        if(fds->ufds[i].fd<0) { /* disabled with s_poll_reset() */
+            if(slot->registered)
+                uring_remove(reactor, slot);
+            continue;
+        }
+        if(slot->registered) {
+            if(slot->events==fds->ufds[i].events)
+                continue; /* the queued request is still valid */
+            uring_remove(reactor, slot);
+        }
+        slot->request=uring_request_new(uring);
+        uring->requests[slot->request].fds=fds;
+        uring->requests[slot->request].index=i;
+        if(uring_poll_add(reactor, fds->ufds[i].fd, fds->ufds[i].events,
+                (__u64)slot->request)) {
+            /* no submission entry available: report as ready */
+            uring_request_free(uring, slot->request);
+            slot->request=-1;
+            fds->ufds[i].revents=fds->ufds[i].events;
+            reactor->current->ready++;
+            continue;
+        }
+        slot->registered=1;
+        slot->events=fds->ufds[i].events;
+    }
+}
+
+/* remove the queued request of a slot */
+NOEXPORT void uring_remove(REACTOR *reactor, EPOLL_SLOT *slot) {
+    URING *uring=reactor->uring;
+
+    /* the request is released when its completion is reported */
+    uring->requests[slot->request].fds=NULL;
+    if(uring_cancel(reactor, slot->request)) { /* retried by uring_retry() */
+        if(uring->num_cancels==uring->allocated_cancels) {
+            uring->allocated_cancels=uring->allocated_cancels ?
+                2*uring->allocated_cancels : 16;
+            uring->cancels=str_realloc(uring->cancels,
+                (size_t)uring->allocated_cancels*sizeof(int));
+            str_detach(uring->cancels);
+        }
+        uring->cancels[uring->num_cancels++]=slot->request;
+    }
+    slot->request=-1;
+    slot->registered=0;
+}
+
+NOEXPORT int uring_cancel(REACTOR *reactor, int id) {
+    struct io_uring_sqe *sqe;
+
+    sqe=uring_get_sqe(reactor);
+    if(!sqe)
+        return 1;
+    sqe->opcode=IORING_OP_POLL_REMOVE;
+    sqe->fd=-1;
+    sqe->addr=(__u64)id;
+    sqe->user_data=URING_REMOVE;
+    uring_queue(reactor->uring);
+    return 0;
+}
+
+/* queue requests that could not get a submission queue entry before */
+NOEXPORT void uring_retry(REACTOR *reactor) {
+    URING *uring=reactor->uring;
+
+    while(uring->num_cancels &&
+            !uring_cancel(reactor, uring->cancels[uring->num_cancels-1]))
+        uring->num_cancels--;
+    if(!uring->wakeup_armed)
+        uring->wakeup_armed=
+            !uring_poll_add(reactor, reactor->wakeup[0], POLLIN, URING_WAKEUP);
+}
+
+NOEXPORT void uring_wait_events(REACTOR *reactor, int timeout) {
+    URING *uring=reactor->uring;
+    struct io_uring_sqe *sqe=NULL;
+    struct pollfd ufd;
+
+    uring_retry(reactor);
+    if(timeout>0) { /* completes on timeout or on the first other event */
+        sqe=uring_get_sqe(reactor);
+        if(sqe) {
+            uring->timeout.tv_sec=timeout/1000;
+            uring->timeout.tv_nsec=(timeout%1000)*1000000L;
+            sqe->opcode=IORING_OP_TIMEOUT;
+            sqe->fd=-1;
+            sqe->addr=(__u64)(unsigned long)&uring->timeout;
+            sqe->len=1;
+            sqe->off=1;
+            sqe->user_data=URING_TIMEOUT;
+            uring_queue(uring);
+        }
+    }
+    if(timeout>0 && !sqe) { /* no entry for the timeout: poll the ring */
+        uring_submit(uring, 0, 0);
+        ufd.fd=uring->fd;
+        ufd.events=POLLIN;
+        if(*uring->cq_head==__atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE))
+            poll(&ufd, 1, timeout);
+    } else { /* submit all queued requests and wait for a completion */
+        uring_submit(uring, timeout ? 1 : 0, IORING_ENTER_GETEVENTS);
+    }
+    uring_completions(reactor);
+}
+
+/* process the completion queue */
+NOEXPORT void uring_completions(REACTOR *reactor) {
+    URING *uring=reactor->uring;
+    URING_REQUEST *request;
+    EPOLL_SLOT *slot;
+    s_poll_set *fds;
+    CONTEXT *context;
+    struct io_uring_cqe *cqe;
+    struct pollfd *ufd;
+    unsigned int head;
+    __u64 user_data;
+    short revents;
+    int id, res, i;
+    char buffer[64];
+
+    /* the head is advanced before each entry is processed, so that */
+    /* uring_get_sqe() may safely call this function recursively */
+    while((head=*uring->cq_head)!=
+            __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+        cqe=uring->cqes+(head&*uring->cq_mask);
+        user_data=cqe->user_data;
+        res=cqe->res;
+        __atomic_store_n(uring->cq_head, head+1, __ATOMIC_RELEASE);
+
+        if(user_data==URING_TIMEOUT || user_data==URING_REMOVE)
+            continue;
+        if(user_data==URING_WAKEUP) { /* new contexts in the inbox */
+            while(read(reactor->wakeup[0], buffer, sizeof buffer)>0)
+                ;
+            uring->wakeup_armed=!uring_poll_add(reactor,
+                reactor->wakeup[0], POLLIN, URING_WAKEUP);
+            continue;
+        }
+        id=(int)user_data;
+        request=uring->requests+id;
+        fds=request->fds;
+        if(!fds) { /* removed with uring_remove() */
+            for(i=0; i<uring->num_cancels; i++)
+                if(uring->cancels[i]==id) /* no longer needs a removal */
+                    uring->cancels[i]=uring->cancels[--uring->num_cancels];
+            uring_request_free(uring, id);
+            continue;
+        }
+        slot=fds->slots+request->index;
+        ufd=fds->ufds+request->index;
+        /* unlike poll(), io_uring may report unrequested POLLRDHUP */
+        revents=res<0 ? POLLNVAL :
+            (short)(res&(slot->events|POLLERR|POLLHUP|POLLNVAL));
+        if(!revents && !uring_poll_add(reactor, fds->fd[request->index],
+                slot->events, (__u64)id)) /* spurious wakeup: poll again */
+            continue;
+        if(!revents) /* no submission entry available: report as ready */
+            revents=slot->events;
+        uring_request_free(uring, id);
+        slot->request=-1;
+        slot->registered=0; /* the request was consumed */
+        if(ufd->fd<0) /* disabled before uring_register() removed it */
+            continue;
+        ufd->revents|=revents;
+        context=fds->context;
+        if(context==reactor->current) { /* reaped during uring_register() */
+            context->ready++;
+        } else if(!context->ready++) {
+            if(context->timer)
+                timer_remove(&reactor->timers, context);
+            ready_append(reactor, context);
+        }
+    }
+}
+
+#endif /* USE_IO_URING */
+
+NOEXPORT void ready_append(REACTOR *reactor, CONTEXT *context) {
+    context->next=NULL;
+    if(reactor->ready_tail)
+        reactor->ready_tail->next=context;
+    reactor->ready_tail=context;
+    if(!reactor->ready_head)
+        reactor->ready_head=context;
+}
+
+#else /* USE_UCONTEXT || USE_EPOLL */
 
 int s_poll_wait(s_poll_set *fds, int sec, int msec) {
     int retval;
@@ -319,7 +1264,7 @@ int s_poll_wait(s_poll_set *fds, int sec, int msec) {
     return retval;
 }
 
-#endif /* USE_UCONTEXT */
+#endif /* USE_UCONTEXT || USE_EPOLL */
 
 #else /* select */
 
@@ -342,22 +1287,62 @@ void s_poll_free(s_poll_set *fds) {
             str_free(fds->owfds);
         if(fds->oxfds)
             str_free(fds->oxfds);
+        if(fds->fd)
+            str_free(fds->fd);
         str_free(fds);
     }
 }
 
 void s_poll_init(s_poll_set *fds) {
+    if(!fds->irfds) { /* keep the memory allocated by previous calls */
 #ifdef USE_WIN32
-    fds->allocated=4; /* prealloc 4 file desciptors */
+        fds->allocated=4; /* prealloc 4 file desciptors */
 #endif
-    s_poll_realloc(fds);
+        s_poll_realloc(fds);
+    }
     FD_ZERO(fds->irfds);
     FD_ZERO(fds->iwfds);
     FD_ZERO(fds->ixfds);
     fds->max=0; /* no file descriptors */
+    fds->nslots=0;
 }
 
 void s_poll_add(s_poll_set *fds, int fd, int rd, int wr) {
+    s_poll_want(fds, s_poll_slot(fds, fd), rd, wr);
+}
+
+/* register a file descriptor once and return its stable slot number */
+int s_poll_slot(s_poll_set *fds, int fd) {
+    unsigned int i;
+
+    for(i=0; i<fds->nslots && fds->fd[i]!=fd; i++)
+        ;
+    if(i==fds->nslots) {
+        if(i==fds->allocated_slots) {
+            fds->allocated_slots=i+4;
+            fds->fd=str_realloc(fds->fd, fds->allocated_slots*sizeof(int));
+        }
+        fds->fd[i]=fd;
+        fds->nslots++;
+    }
+    return (int)i;
+}
+
+/* clear the interest of all slots without releasing them */
+void s_poll_reset(s_poll_set *fds) {
+    FD_ZERO(fds->irfds);
+    FD_ZERO(fds->iwfds);
+    FD_ZERO(fds->ixfds);
+    FD_ZERO(fds->orfds);
+    FD_ZERO(fds->owfds);
+    FD_ZERO(fds->oxfds);
+    fds->max=0;
+}
+
+/* poll the slot (for errors and hangups) and add the requested interest */
+void s_poll_want(s_poll_set *fds, int slot, int rd, int wr) {
+    int fd=fds->fd[slot];
+
 #ifdef USE_WIN32
     /* fds->ixfds contains union of fds->irfds and fds->iwfds */
     if(fds->ixfds->fd_count>=fds->allocated) {
@@ -375,27 +1360,29 @@ void s_poll_add(s_poll_set *fds, int fd, int rd, int wr) {
         fds->max=fd;
 }
 
-int s_poll_canread(s_poll_set *fds, int fd) {
-    return FD_ISSET(fd, fds->orfds);
+int s_poll_slot_canread(s_poll_set *fds, int slot) {
+    return FD_ISSET(fds->fd[slot], fds->orfds);
 }
 
-int s_poll_canwrite(s_poll_set *fds, int fd) {
-    return FD_ISSET(fd, fds->owfds);
+int s_poll_slot_canwrite(s_poll_set *fds, int slot) {
+    return FD_ISSET(fds->fd[slot], fds->owfds);
 }
 
-int s_poll_hup(s_poll_set *fds, int fd) {
+int s_poll_slot_hup(s_poll_set *fds, int slot) {
     (void)fds; /* skip warning about unused parameter */
-    (void)fd; /* skip warning about unused parameter */
+    (void)slot; /* skip warning about unused parameter */
     return 0; /* FIXME: how to detect HUP condition with select()? */
 }
 
-int s_poll_rdhup(s_poll_set *fds, int fd) {
+int s_poll_slot_rdhup(s_poll_set *fds, int slot) {
     (void)fds; /* skip warning about unused parameter */
-    (void)fd; /* skip warning about unused parameter */
+    (void)slot; /* skip warning about unused parameter */
     return 0; /* FIXME: how to detect RDHUP condition with select()? */
 }
 
-int s_poll_error(s_poll_set *fds, int fd) {
+int s_poll_slot_error(s_poll_set *fds, int slot) {
+    int fd=fds->fd[slot];
+
     /* error conditions are signaled as read, but apparently *not* in Winsock:
      * http://msdn.microsoft.com/en-us/library/windows/desktop/ms737625%28v=vs.85%29.aspx */
     if(!FD_ISSET(fd, fds->orfds) && !FD_ISSET(fd, fds->oxfds))
@@ -403,6 +1390,16 @@ int s_poll_error(s_poll_set *fds, int fd) {
     return get_socket_error(fd); /* check if it's really an error */
 }
 
+/* slot of a registered file descriptor or -1 */
+NOEXPORT int s_poll_find(s_poll_set *fds, int fd) {
+    unsigned int i;
+
+    for(i=0; i<fds->nslots; i++)
+        if(fds->fd[i]==fd)
+            return (int)i;
+    return -1; /* not listed in fds */
+}
+
 #ifdef USE_WIN32
 #define FD_SIZE(fds) (sizeof(u_int)+(fds)->allocated*sizeof(SOCKET))
 #else
@@ -440,6 +1437,38 @@ NOEXPORT void s_poll_realloc(s_poll_set *fds) {
 
 #endif /* USE_POLL */
 
+/* file descriptor lookups for callers that do not keep slot numbers */
+
+int s_poll_canread(s_poll_set *fds, int fd) {
+    int slot=s_poll_find(fds, fd);
+
+    return slot<0 ? 0 : s_poll_slot_canread(fds, slot);
+}
+
+int s_poll_canwrite(s_poll_set *fds, int fd) {
+    int slot=s_poll_find(fds, fd);
+
+    return slot<0 ? 0 : s_poll_slot_canwrite(fds, slot);
+}
+
+int s_poll_hup(s_poll_set *fds, int fd) {
+    int slot=s_poll_find(fds, fd);
+
+    return slot<0 ? 0 : s_poll_slot_hup(fds, slot);
+}
+
+int s_poll_rdhup(s_poll_set *fds, int fd) {
+    int slot=s_poll_find(fds, fd);
+
+    return slot<0 ? 0 : s_poll_slot_rdhup(fds, slot);
+}
+
+int s_poll_error(s_poll_set *fds, int fd) {
+    int slot=s_poll_find(fds, fd);
+
+    return slot<0 ? 0 : s_poll_slot_error(fds, slot);
+}
+
 /**************************************** fd management */
 
 int set_socket_options(int s, int type) {
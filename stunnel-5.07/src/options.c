@@ -318,7 +318,7 @@ int options_parse(CONF_TYPE type) {
             new_section=str_alloc(sizeof(SERVICE_OPTIONS));
             memcpy(new_section, &new_service_options, sizeof(SERVICE_OPTIONS));
             new_section->servname=str_dup(config_opt);
-            new_section->session=NULL;
+            memset(new_section->session, 0, sizeof new_section->session);
             new_section->next=NULL;
             section->next=new_section;
             section=new_section;
@@ -402,6 +402,31 @@ NOEXPORT char *parse_global_option(CMD cmd, char *opt, char *arg) {
         s_log(LOG_NOTICE, "Global options:");
     }
 
+    /* acceptBatch */
+    switch(cmd) {
+    case CMD_BEGIN:
+        new_global_options.accept_batch=16;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "acceptBatch"))
+            break;
+        new_global_options.accept_batch=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr || new_global_options.accept_batch<1)
+            return "Illegal number of connections to accept";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = %d", "acceptBatch", 16);
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = connections accepted per wakeup",
+            "acceptBatch");
+        break;
+    }
+
     /* chroot */
 #ifdef HAVE_CHROOT
     switch(cmd) {
@@ -721,6 +746,63 @@ NOEXPORT char *parse_global_option(CMD cmd, char *opt, char *arg) {
 
 #endif /* ICON_IMAGE */
 
+    /* ioUring */
+#ifdef USE_IO_URING
+    switch(cmd) {
+    case CMD_BEGIN:
+        new_global_options.option.io_uring=0;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "ioUring"))
+            break;
+        if(!strcasecmp(arg, "yes"))
+            new_global_options.option.io_uring=1;
+        else if(!strcasecmp(arg, "no"))
+            new_global_options.option.io_uring=0;
+        else
+            return "Argument should be either 'yes' or 'no'";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = yes|no use io_uring in reactor threads",
+            "ioUring");
+        break;
+    }
+#endif /* USE_IO_URING */
+
+#ifdef USE_ASYNC_KEYS
+    /* keyWorkers */
+    switch(cmd) {
+    case CMD_BEGIN:
+        new_global_options.key_workers=0; /* inline */
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "keyWorkers"))
+            break;
+        new_global_options.key_workers=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr || new_global_options.key_workers<0)
+            return "Illegal number of key worker threads";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = 0", "keyWorkers");
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE,
+            "%-22s = number of threads for private key operations",
+            "keyWorkers");
+        break;
+    }
+#endif /* USE_ASYNC_KEYS */
+
     /* log */
     switch(cmd) {
     case CMD_BEGIN:
@@ -795,6 +877,32 @@ NOEXPORT char *parse_global_option(CMD cmd, char *opt, char *arg) {
     }
 #endif
 
+    /* reactors */
+#ifdef USE_EPOLL
+    switch(cmd) {
+    case CMD_BEGIN:
+        new_global_options.reactors=0; /* one reactor per CPU */
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "reactors"))
+            break;
+        new_global_options.reactors=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr || new_global_options.reactors<0)
+            return "Illegal number of reactor threads";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = number of CPUs", "reactors");
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = number of reactor threads", "reactors");
+        break;
+    }
+#endif /* USE_EPOLL */
+
     /* RNDbytes */
     switch(cmd) {
     case CMD_BEGIN:
@@ -1034,6 +1142,89 @@ NOEXPORT char *parse_global_option(CMD cmd, char *opt, char *arg) {
     }
 #endif
 
+#ifdef USE_PTHREAD
+    /* workersIdle */
+    switch(cmd) {
+    case CMD_BEGIN:
+        new_global_options.workers_idle=60; /* 1 minute */
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "workersIdle"))
+            break;
+        new_global_options.workers_idle=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr || new_global_options.workers_idle<0)
+            return "Illegal worker idle timeout";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = %d seconds", "workersIdle", 60);
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = seconds to keep idle worker threads",
+            "workersIdle");
+        break;
+    }
+
+    /* workersMax */
+    switch(cmd) {
+    case CMD_BEGIN:
+        new_global_options.workers_max=0; /* no limit */
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "workersMax"))
+            break;
+        new_global_options.workers_max=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr || new_global_options.workers_max<0)
+            return "Illegal number of worker threads";
+        return NULL; /* OK */
+    case CMD_END:
+        if(new_global_options.workers_max &&
+                new_global_options.workers_min>new_global_options.workers_max)
+            return "workersMin exceeds workersMax";
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = no limit", "workersMax");
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = maximum number of worker threads",
+            "workersMax");
+        break;
+    }
+
+    /* workersMin */
+    switch(cmd) {
+    case CMD_BEGIN:
+        new_global_options.workers_min=0;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "workersMin"))
+            break;
+        new_global_options.workers_min=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr || new_global_options.workers_min<0)
+            return "Illegal number of worker threads";
+        return NULL; /* OK */
+    case CMD_END:
+        /* pre-spawned workers would never receive any clients */
+        if(new_global_options.workers_min && !new_global_options.workers_idle)
+            return "workersMin requires a non-zero workersIdle";
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = 0", "workersMin");
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = number of pre-spawned worker threads",
+            "workersMin");
+        break;
+    }
+#endif /* USE_PTHREAD */
+
     if(cmd==CMD_EXEC)
         return option_not_found;
 
@@ -1087,6 +1278,57 @@ NOEXPORT char *parse_service_option(CMD cmd, SERVICE_OPTIONS *section,
         break;
     }
 
+    /* bufferRelease */
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->buffer_release=0;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "bufferRelease"))
+            break;
+        section->buffer_release=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr || section->buffer_release<0)
+            return "Illegal buffer release time";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = %d seconds", "bufferRelease", 0);
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = seconds to keep buffers of an idle connection",
+            "bufferRelease");
+        break;
+    }
+
+    /* bufferSize */
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->buffer_size=BUFFSIZE;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "bufferSize"))
+            break;
+        section->buffer_size=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr ||
+                section->buffer_size<1024 || section->buffer_size>1048576)
+            return "Illegal buffer size";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = %d bytes", "bufferSize", BUFFSIZE);
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = size of each transfer buffer",
+            "bufferSize");
+        break;
+    }
+
     /* CApath */
     switch(cmd) {
     case CMD_BEGIN:
@@ -1244,6 +1486,34 @@ NOEXPORT char *parse_service_option(CMD cmd, SERVICE_OPTIONS *section,
         break;
     }
 
+    /* coalesceDelay */
+#ifndef USE_WIN32
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->coalesce_delay=0;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "coalesceDelay"))
+            break;
+        section->coalesce_delay=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr ||
+                section->coalesce_delay<0 || section->coalesce_delay>1000000)
+            return "Illegal coalescing delay";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = %d microseconds", "coalesceDelay", 0);
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = microseconds to wait for a full SSL record",
+            "coalesceDelay");
+        break;
+    }
+#endif /* !USE_WIN32 */
+
     /* connect */
     switch(cmd) {
     case CMD_BEGIN:
@@ -1631,6 +1901,8 @@ NOEXPORT char *parse_service_option(CMD cmd, SERVICE_OPTIONS *section,
         section->option.ocsp=0;
         memset(&section->ocsp_addr, 0, sizeof(SOCKADDR_UNION));
         section->ocsp_addr.in.sin_family=AF_INET;
+        section->ocsp_cache=NULL;
+        section->ocsp_cached=section->ocsp_refreshing=0;
         break;
     case CMD_EXEC:
         if(strcasecmp(opt, "ocsp"))
@@ -1672,6 +1944,46 @@ NOEXPORT char *parse_service_option(CMD cmd, SERVICE_OPTIONS *section,
         break;
     }
 
+#ifdef USE_OCSP_STAPLING
+    /* OCSPstapling */
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->option.ocsp_stapling=0;
+        section->staple_path=NULL;
+        section->staple_store=NULL;
+        section->staple_certs=NULL;
+        section->ocsp_staple=NULL;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "OCSPstapling"))
+            break;
+        if(!strcasecmp(arg, "yes"))
+            section->option.ocsp_stapling=1;
+        else if(!strcasecmp(arg, "no"))
+            section->option.ocsp_stapling=0;
+        else
+            return "Argument should be either 'yes' or 'no'";
+        return NULL; /* OK */
+    case CMD_END:
+        if(section->option.ocsp_stapling) {
+            if(section->option.client)
+                return "OCSPstapling is only allowed in server mode";
+            if(!section->cert)
+                return "OCSPstapling requires a certificate";
+        }
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = no", "OCSPstapling");
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = yes|no staple OCSP responses",
+            "OCSPstapling");
+        break;
+    }
+#endif /* USE_OCSP_STAPLING */
+
 #endif /* HAVE_OSSL_OCSP_H */
 
     /* options */
@@ -1709,6 +2021,35 @@ NOEXPORT char *parse_service_option(CMD cmd, SERVICE_OPTIONS *section,
         break;
     }
 
+    /* overload */
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->overload=OVERLOAD_PAUSE;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "overload"))
+            break;
+        if(!strcasecmp(arg, "pause"))
+            section->overload=OVERLOAD_PAUSE;
+        else if(!strcasecmp(arg, "reject"))
+            section->overload=OVERLOAD_REJECT;
+        else if(!strcasecmp(arg, "reset"))
+            section->overload=OVERLOAD_RESET;
+        else
+            return "Argument should be either 'pause', 'reject' or 'reset'";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = pause|reject|reset overload policy",
+            "overload");
+        break;
+    }
+
     /* protocol */
     switch(cmd) {
     case CMD_BEGIN:
@@ -1854,6 +2195,85 @@ NOEXPORT char *parse_service_option(CMD cmd, SERVICE_OPTIONS *section,
     }
 #endif
 
+    /* recordSizeBoost */
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->record_size_boost=1048576;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "recordSizeBoost"))
+            break;
+        section->record_size_boost=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr ||
+                section->record_size_boost<0)
+            return "Illegal number of bytes";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = %d bytes", "recordSizeBoost", 1048576);
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = bytes sent in small SSL records",
+            "recordSizeBoost");
+        break;
+    }
+
+    /* recordSizeIdle */
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->record_size_idle=1;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "recordSizeIdle"))
+            break;
+        section->record_size_idle=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr ||
+                section->record_size_idle<1)
+            return "Illegal idle time";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = %d seconds", "recordSizeIdle", 1);
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = idle time before small SSL records are used again",
+            "recordSizeIdle");
+        break;
+    }
+
+    /* recordSizeMin */
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->record_size_min=0;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "recordSizeMin"))
+            break;
+        section->record_size_min=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr ||
+                section->record_size_min<0 ||
+                section->record_size_min>SSL3_RT_MAX_PLAIN_LENGTH)
+            return "Illegal SSL record size";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = %d bytes", "recordSizeMin", 0);
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = initial SSL record size (0 - disabled)",
+            "recordSizeMin");
+        break;
+    }
+
     /* redirect */
     switch(cmd) {
     case CMD_BEGIN:
@@ -1967,6 +2387,35 @@ NOEXPORT char *parse_service_option(CMD cmd, SERVICE_OPTIONS *section,
         break;
     }
 
+    /* reusePort */
+#ifdef USE_EPOLL
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->option.reuseport=0;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "reusePort"))
+            break;
+        if(!strcasecmp(arg, "yes"))
+            section->option.reuseport=1;
+        else if(!strcasecmp(arg, "no"))
+            section->option.reuseport=0;
+        else
+            return "Argument should be either 'yes' or 'no'";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = yes|no accept connections on each reactor",
+            "reusePort");
+        break;
+    }
+#endif /* USE_EPOLL */
+
     /* sessionCacheSize */
     switch(cmd) {
     case CMD_BEGIN:
@@ -2016,6 +2465,100 @@ NOEXPORT char *parse_service_option(CMD cmd, SERVICE_OPTIONS *section,
         break;
     }
 
+#ifndef USE_FORK
+    /* sessionFile */
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->session_file=NULL;
+        section->session_file_saved=0;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "sessionFile"))
+            break;
+        section->session_file=str_dup(arg);
+        return NULL; /* OK */
+    case CMD_END:
+        if(section->session_file && !section->option.client) {
+            if(section->option.sessiond)
+                return "sessionFile and sessiond are mutually exclusive";
+#ifndef USE_WIN32
+            if(section->session_shm)
+                return "sessionFile and sessionShm are mutually exclusive";
+#endif
+        }
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = file to save the cached sessions",
+            "sessionFile");
+        break;
+    }
+
+    /* sessionFileInterval */
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->session_file_interval=60;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "sessionFileInterval"))
+            break;
+        section->session_file_interval=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr || section->session_file_interval<=0)
+            return "Illegal session file interval";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = %d seconds", "sessionFileInterval", 60);
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = seconds between saving the session file",
+            "sessionFileInterval");
+        break;
+    }
+#endif /* !USE_FORK */
+
+#ifndef USE_WIN32
+    /* sessionShm */
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->session_shm=NULL;
+        section->shm_cache=NULL;
+        section->shm_fd=-1;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "sessionShm"))
+            break;
+        section->session_shm=str_dup(arg);
+#ifdef SSL_OP_NO_TICKET
+        /* session tickets would bypass the session cache callbacks */
+        section->ssl_options_set|=SSL_OP_NO_TICKET;
+#endif
+        return NULL; /* OK */
+    case CMD_END:
+        if(section->session_shm) {
+            if(section->option.sessiond)
+                return "sessionShm and sessiond are mutually exclusive";
+            if(section->session_size<=0)
+                return "sessionShm requires a positive sessionCacheSize";
+        }
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = file of the shared memory session cache",
+            "sessionShm");
+        break;
+    }
+#endif /* !USE_WIN32 */
+
     /* sessiond */
     switch(cmd) {
     case CMD_BEGIN:
@@ -2047,6 +2590,32 @@ NOEXPORT char *parse_service_option(CMD cmd, SERVICE_OPTIONS *section,
         break;
     }
 
+    /* sessiondTimeout */
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->sessiond_timeout=200; /* milliseconds */
+        section->sessiond_idle=0;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "sessiondTimeout"))
+            break;
+        section->sessiond_timeout=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr || section->sessiond_timeout<=0)
+            return "Illegal sessiond timeout";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = %d milliseconds", "sessiondTimeout", 200);
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = milliseconds to wait for a sessiond lookup",
+            "sessiondTimeout");
+        break;
+    }
+
 #ifndef OPENSSL_NO_TLSEXT
     /* sni */
     switch(cmd) {
@@ -2185,6 +2754,124 @@ NOEXPORT char *parse_service_option(CMD cmd, SERVICE_OPTIONS *section,
     }
 #endif
 
+#ifndef OPENSSL_NO_TLSEXT
+    /* ticketKeyFile */
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->ticket_key_file=NULL;
+        section->ticket_keys=NULL;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "ticketKeyFile"))
+            break;
+        section->ticket_key_file=str_dup(arg);
+        return NULL; /* OK */
+    case CMD_END:
+        if(section->ticket_key_file) {
+            if(section->option.client)
+                return "ticketKeyFile is only allowed in server mode";
+#ifdef SSL_OP_NO_TICKET
+            /* enabled even with sessiond or sessionShm */
+            section->ssl_options_set&=~SSL_OP_NO_TICKET;
+#endif
+        }
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = file with the session ticket key secrets",
+            "ticketKeyFile");
+        break;
+    }
+
+    /* ticketKeyGrace */
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->ticket_key_grace=-1; /* the value of ticketKeyRotate */
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "ticketKeyGrace"))
+            break;
+        section->ticket_key_grace=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr || section->ticket_key_grace<0)
+            return "Illegal ticket key grace period";
+        return NULL; /* OK */
+    case CMD_END:
+        if(section->ticket_key_grace<0) {
+            section->ticket_key_grace=section->ticket_key_rotate;
+            break;
+        }
+        if(!section->ticket_key_rotate)
+            return "ticketKeyGrace requires ticketKeyRotate";
+        /* retired keys of each secret are limited to 6 rotation periods */
+        if(section->ticket_key_grace>6*section->ticket_key_rotate)
+            return "ticketKeyGrace exceeds 6 times ticketKeyRotate";
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = seconds to accept tickets of rotated keys",
+            "ticketKeyGrace");
+        break;
+    }
+
+    /* ticketKeyReload */
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->ticket_key_reload=60; /* 1 minute */
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "ticketKeyReload"))
+            break;
+        section->ticket_key_reload=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr || section->ticket_key_reload<=0)
+            return "Illegal ticket key reload interval";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = %d seconds", "ticketKeyReload", 60);
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = seconds between reads of ticketKeyFile",
+            "ticketKeyReload");
+        break;
+    }
+
+    /* ticketKeyRotate */
+    switch(cmd) {
+    case CMD_BEGIN:
+        section->ticket_key_rotate=0; /* only rotated by replacing the file */
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "ticketKeyRotate"))
+            break;
+        section->ticket_key_rotate=strtol(arg, &tmpstr, 10);
+        if(tmpstr==arg || *tmpstr || section->ticket_key_rotate<0)
+            return "Illegal ticket key rotation interval";
+        return NULL; /* OK */
+    case CMD_END:
+        if(section->ticket_key_rotate && !section->ticket_key_file)
+            return "ticketKeyRotate requires ticketKeyFile";
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        s_log(LOG_NOTICE, "%-22s = %d seconds", "ticketKeyRotate", 0);
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = seconds between session ticket key rotations",
+            "ticketKeyRotate");
+        break;
+    }
+#endif /* OPENSSL_NO_TLSEXT */
+
     /* TIMEOUTbusy */
     switch(cmd) {
     case CMD_BEGIN:
@@ -2362,6 +3049,34 @@ NOEXPORT char *parse_service_option(CMD cmd, SERVICE_OPTIONS *section,
         break;
     }
 
+    /* wipeBuffers */
+    switch(cmd) {
+    case CMD_BEGIN:
+        /* enabled by default: released buffers are reused by other clients */
+        section->option.wipe_buffers=1;
+        break;
+    case CMD_EXEC:
+        if(strcasecmp(opt, "wipeBuffers"))
+            break;
+        if(!strcasecmp(arg, "yes"))
+            section->option.wipe_buffers=1;
+        else if(!strcasecmp(arg, "no"))
+            section->option.wipe_buffers=0;
+        else
+            return "Argument should be either 'yes' or 'no'";
+        return NULL; /* OK */
+    case CMD_END:
+        break;
+    case CMD_FREE:
+        break;
+    case CMD_DEFAULT:
+        break;
+    case CMD_HELP:
+        s_log(LOG_NOTICE, "%-22s = yes|no clear released I/O buffers",
+            "wipeBuffers");
+        break;
+    }
+
     if(cmd==CMD_EXEC)
         return option_not_found;
 
@@ -2377,6 +3092,9 @@ NOEXPORT char *parse_service_option(CMD cmd, SERVICE_OPTIONS *section,
             if(endpoints!=1)
                 return "Inetd mode must define one endpoint";
         }
+#ifdef USE_ASYNC_KEYS
+        section->option.async_keys=new_global_options.key_workers>0;
+#endif
         if(context_init(section)) /* initialize SSL context */
             return "Failed to initialize SSL context";
     }
@@ -105,7 +105,23 @@ typedef struct {
     char *rand_file;                                /* file with random data */
     int random_bytes;                       /* how many random bytes to read */
 
+#ifdef USE_PTHREAD
+        /* some global data for sthreads.c */
+    int workers_min;                  /* number of pre-spawned worker threads */
+    int workers_max;                /* maximum number of workers (0=no limit) */
+    int workers_idle;                 /* idle worker timeout (0=no pool) */
+#endif
+#ifdef USE_EPOLL
+        /* some global data for sthreads.c */
+    int reactors;                     /* number of reactor threads (0=auto) */
+#endif
+#ifdef USE_ASYNC_KEYS
+        /* some global data for sthreads.c and ctx.c */
+    int key_workers;            /* number of key worker threads (0=inline) */
+#endif
+
         /* some global data for stunnel.c */
+    int accept_batch;          /* connections accepted on a single wakeup */
 #ifndef USE_WIN32
 #ifdef HAVE_CHROOT
     char *chroot_dir;
@@ -139,6 +155,9 @@ typedef struct {
 #endif
 #ifdef USE_FIPS
         unsigned int fips:1;                       /* enable FIPS 140-2 mode */
+#endif
+#ifdef USE_IO_URING
+        unsigned int io_uring:1;          /* use io_uring in reactor threads */
 #endif
     } option;
 } GLOBAL_OPTIONS;
@@ -149,6 +168,17 @@ extern GLOBAL_OPTIONS global_options;
 typedef struct servername_list_struct SERVERNAME_LIST;/* forward declaration */
 #endif
 
+typedef struct cached_session_struct {
+    struct cached_session_struct *prev, *next;
+    char *key;                 /* destination and SNI, or server session id */
+    SSL_SESSION *session;
+} CACHED_SESSION;
+
+typedef struct {
+    CACHED_SESSION *head, *tail;            /* most and least recently used */
+    long count;
+} SESSION_STRIPE;
+
 typedef struct service_options_struct {
     struct service_options_struct *next;   /* next node in the services list */
     SSL_CTX *ctx;                                            /*  SSL context */
@@ -170,6 +200,15 @@ typedef struct service_options_struct {
     SOCKADDR_UNION ocsp_addr;
     char *ocsp_path;
     unsigned long ocsp_flags;
+    struct OCSP_ENTRY_STRUCTURE *ocsp_cache;        /* cached OCSP responses */
+    int ocsp_cached, ocsp_refreshing;
+#endif
+#ifdef USE_OCSP_STAPLING
+    SOCKADDR_UNION staple_addr;      /* responder of the local certificate */
+    char *staple_path;
+    X509_STORE *staple_store;         /* issuer of the local certificate */
+    STACK_OF(X509) *staple_certs;
+    struct OCSP_ENTRY_STRUCTURE *ocsp_staple;      /* stapled OCSP response */
 #endif
 
         /* service-specific data for ctx.c */
@@ -177,12 +216,29 @@ typedef struct service_options_struct {
     char *cert;                                             /* cert filename */
     char *key;                               /* pem (priv key/cert) filename */
     long session_size, session_timeout;
+    char *session_file;                       /* file to persist sessions */
+    long session_file_interval;
     long ssl_options_set, ssl_options_clear;
     SSL_METHOD *client_method, *server_method;
     SOCKADDR_UNION sessiond_addr;
+    int sessiond_timeout;                /* lookup timeout in milliseconds */
+    int sessiond_fd[SESSIOND_SOCKETS];     /* idle connected UDP sockets */
+    int sessiond_idle;                       /* number of idle sockets */
+#ifndef USE_WIN32
+    char *session_shm;                /* shared memory session cache file */
+    struct SHM_CACHE_STRUCTURE *shm_cache;        /* mapped session cache */
+    int shm_fd;                  /* file descriptor of the mapped cache */
+#endif
 #ifndef OPENSSL_NO_TLSEXT
     char *sni;
     SERVERNAME_LIST *servername_list_head, *servername_list_tail;
+    char *ticket_key_file;            /* file with the ticket key secrets */
+    struct TICKET_KEYS_STRUCTURE *ticket_keys;     /* current key first */
+    long ticket_key_reload;     /* seconds between reads of ticketKeyFile */
+    long ticket_key_rotate;       /* seconds between key rotations (0=none) */
+    long ticket_key_grace;      /* seconds to accept keys of past periods */
+    time_t ticket_keys_loaded;             /* last read of ticketKeyFile */
+    long ticket_keys_period;        /* rotation period of the current key */
 #endif
 #ifndef OPENSSL_NO_ECDH
     int curve;
@@ -193,7 +249,19 @@ typedef struct service_options_struct {
 
         /* service-specific data for client.c */
     int fd;        /* file descriptor accepting connections for this service */
-    SSL_SESSION *session;                           /* recently used session */
+    unsigned long accepted, shed;             /* connections accepted or shed */
+    unsigned long released;                      /* idle buffer releases */
+    unsigned long pooled, freed;  /* bytes returned to the pool or freed */
+    unsigned long ssl_released;      /* successful SSL_free_buffers() calls */
+    unsigned long released_logged;       /* releases in the last log entry */
+    time_t released_checked;     /* last periodic check of the counters */
+    int overloaded;                /* connections are currently being shed */
+    unsigned long shed_before;     /* connections shed before this overload */
+#ifdef USE_EPOLL
+    int *reactor_fds;         /* SO_REUSEPORT sockets accepted by reactors */
+#endif
+    SESSION_STRIPE session[SESSION_STRIPES];  /* sessions to reuse or save */
+    time_t session_file_saved;                /* last save of sessionFile */
     char *execname;                           /* program name for local mode */
 #ifdef USE_WIN32
     char *execargs;                      /* program arguments for local mode */
@@ -207,7 +275,16 @@ typedef struct service_options_struct {
     int timeout_close;                          /* maximum close_notify time */
     int timeout_connect;                           /* maximum connect() time */
     int timeout_idle;                        /* maximum idle connection time */
+    int buffer_size;                      /* size of each transfer() buffer */
+    int buffer_release;    /* seconds of inactivity before buffers released */
+#ifndef USE_WIN32
+    long coalesce_delay;         /* microseconds to wait for more SSL data */
+#endif
+    int record_size_min;     /* initial SSL record payload size or 0 if off */
+    int record_size_boost;      /* bytes to send before full-size records */
+    int record_size_idle;       /* seconds to start over with small records */
     enum {FAILOVER_RR, FAILOVER_PRIO} failover;         /* failover strategy */
+    enum {OVERLOAD_PAUSE, OVERLOAD_REJECT, OVERLOAD_RESET} overload;
     char *username;
 
         /* service-specific data for protocol.c */
@@ -247,10 +324,20 @@ typedef struct service_options_struct {
 #endif
 #ifdef HAVE_OSSL_OCSP_H
         unsigned int ocsp:1;
+#endif
+#ifdef USE_OCSP_STAPLING
+        unsigned int ocsp_stapling:1;
 #endif
         unsigned int reset:1;           /* reset sockets on error */
         unsigned int renegotiation:1;
         unsigned int connect_before_ssl:1;
+        unsigned int wipe_buffers:1;    /* clear buffers of closed clients */
+#ifdef USE_ASYNC_KEYS
+        unsigned int async_keys:1;      /* use key workers (keyWorkers) */
+#endif
+#ifdef USE_EPOLL
+        unsigned int reuseport:1;       /* per-reactor listening sockets */
+#endif
     } option;
 } SERVICE_OPTIONS;
 
@@ -292,16 +379,22 @@ typedef enum {
 
 typedef struct {
 #ifdef USE_POLL
-    struct pollfd *ufds;
+    struct pollfd *ufds; /* fd is negative for disabled slots */
     unsigned int nfds;
     unsigned int allocated;
+#if defined(USE_UCONTEXT_EPOLL) || defined(USE_EPOLL)
+    struct EPOLL_SLOT_STRUCTURE *slots; /* epoll registrations of slots */
+    struct CONTEXT_STRUCTURE *context; /* owner of registrations or NULL */
+#endif
 #else /* select */
     fd_set *irfds, *iwfds, *ixfds, *orfds, *owfds, *oxfds;
     int max;
+    unsigned int nslots, allocated_slots;
 #ifdef USE_WIN32
     unsigned int allocated;
 #endif
 #endif
+    int *fd; /* registered file descriptor of each slot */
 } s_poll_set;
 
 typedef struct disk_file {
@@ -401,11 +494,22 @@ typedef struct {
 } UI_DATA;
 
 int context_init(SERVICE_OPTIONS *);
+void session_cache_get(SERVICE_OPTIONS *, const char *, SSL *);
+void session_cache_put(SERVICE_OPTIONS *, const char *, SSL_SESSION *);
+void session_file_load(SERVICE_OPTIONS *);
+void session_file_save(SERVICE_OPTIONS *);
+#ifndef OPENSSL_NO_TLSEXT
+int ticket_keys_timer(SERVICE_OPTIONS *);
+#endif
 void sslerror(char *);
 
 /**************************************** prototypes for verify.c */
 
 int verify_init(SERVICE_OPTIONS *);
+#ifdef USE_OCSP_STAPLING
+int ocsp_staple_init(SERVICE_OPTIONS *);
+int ocsp_staple_timer(SERVICE_OPTIONS *);
+#endif
 char *X509_NAME2text(X509_NAME *);
 
 /**************************************** prototypes for network.c */
@@ -414,6 +518,14 @@ s_poll_set *s_poll_alloc(void);
 void s_poll_free(s_poll_set *);
 void s_poll_init(s_poll_set *);
 void s_poll_add(s_poll_set *, int, int, int);
+int s_poll_slot(s_poll_set *, int);
+void s_poll_reset(s_poll_set *);
+void s_poll_want(s_poll_set *, int, int, int);
+int s_poll_slot_canread(s_poll_set *, int);
+int s_poll_slot_canwrite(s_poll_set *, int);
+int s_poll_slot_hup(s_poll_set *, int);
+int s_poll_slot_rdhup(s_poll_set *, int);
+int s_poll_slot_error(s_poll_set *, int);
 int s_poll_canread(s_poll_set *, int);
 int s_poll_canwrite(s_poll_set *, int);
 int s_poll_hup(s_poll_set *, int);
@@ -460,18 +572,25 @@ typedef struct {
     RENEG_STATE reneg_state; /* used to track renegotiation attempts */
 
     /* data for transfer() function */
-    char sock_buff[BUFFSIZE]; /* socket read buffer */
-    char ssl_buff[BUFFSIZE]; /* SSL read buffer */
-    int sock_ptr, ssl_ptr; /* index of first unused byte in buffer */
+    char *sock_buff; /* socket read buffer (pooled, allocated on demand) */
+    char *ssl_buff; /* SSL read buffer (shares the allocation of sock_buff) */
+    int buff_size; /* size of each buffer */
+    int sock_top, ssl_top; /* end of the used part of each buffer */
+    int sock_head, ssl_head; /* index of first buffered byte (ring buffer) */
+    int sock_ptr, ssl_ptr; /* number of buffered bytes */
     FD *sock_rfd, *sock_wfd; /* read and write socket descriptors */
     FD *ssl_rfd, *ssl_wfd; /* read and write SSL descriptors */
     int sock_bytes, ssl_bytes; /* bytes written to socket and SSL */
+    int record_bytes; /* bytes sent since small SSL records were started */
+    time_t record_time; /* time of the last SSL_write() */
     s_poll_set *fds; /* file descriptors */
 } CLI;
 
 CLI *alloc_client_session(SERVICE_OPTIONS *, int, int);
 void *client_thread(void *);
 void client_main(CLI *);
+void idle_release_stats(SERVICE_OPTIONS *);
+int idle_release_timer(SERVICE_OPTIONS *);
 
 /**************************************** prototypes for network.c */
 
@@ -544,21 +663,61 @@ int getnameinfo(const struct sockaddr *, int, char *, int, char *, int, int);
 /**************************************** prototypes for sthreads.c */
 
 typedef enum {
-    CRIT_CLIENTS, CRIT_SESSION, CRIT_SSL,   /* client.c */
+    CRIT_CLIENTS, CRIT_SSL,                 /* client.c */
+    CRIT_SESSION,                           /* ctx.c */
+    CRIT_SESSION_LAST=CRIT_SESSION+SESSION_STRIPES-1,
+    CRIT_SESSIOND,                          /* ctx.c */
+    CRIT_TICKET,                            /* ctx.c */
+    CRIT_OCSP,                              /* verify.c */
+    CRIT_BUFFERS,                           /* client.c */
     CRIT_INET,                              /* resolver.c */
 #ifndef USE_WIN32
     CRIT_LIBWRAP,                           /* libwrap.c */
 #endif
     CRIT_LOG,                               /* log.c */
+    CRIT_ACCEPT,                            /* stunnel.c */
+#ifdef USE_EPOLL
+    CRIT_THREADS,                           /* sthreads.c */
+#endif
     CRIT_SECTIONS                           /* number of critical sections */
 } SECTION_CODE;
 
 void enter_critical_section(SECTION_CODE);
 void leave_critical_section(SECTION_CODE);
 int sthreads_init(void);
+#if defined(USE_PTHREAD) || defined(USE_EPOLL)
+int sthreads_start(void);
+#endif
+#ifdef USE_ASYNC_KEYS
+typedef struct KEYOP_STRUCTURE {
+    void (*func)(struct KEYOP_STRUCTURE *);  /* executed by a key worker */
+    void (*cleanup)(struct KEYOP_STRUCTURE *);  /* releases the operation */
+    int wakeup[2];                  /* pipe signalled after func() returns */
+    int pending;               /* queued or executed by a key worker */
+    int orphan;                /* released while pending */
+    struct KEYOP_STRUCTURE *next;
+} KEYOP;
+int keyop_queue(KEYOP *);
+void keyop_release(KEYOP *);
+#endif /* USE_ASYNC_KEYS */
 unsigned long stunnel_process_id(void);
 unsigned long stunnel_thread_id(void);
 int create_client(int, int, CLI *, void *(*)(void *));
+#if defined(USE_UCONTEXT_EPOLL) || defined(USE_EPOLL)
+typedef struct EPOLL_SLOT_STRUCTURE {
+    s_poll_set *fds; /* set owning this slot */
+    unsigned int index; /* index of the slot in fds */
+    int registered; /* the descriptor is registered with epoll */
+    short events; /* registered events */
+#ifdef USE_IO_URING
+    int request; /* pending io_uring poll request or -1 */
+#endif
+} EPOLL_SLOT;
+typedef struct {
+    struct CONTEXT_STRUCTURE **contexts; /* binary heap ordered by finish */
+    unsigned int count, allocated;
+} TIMER_HEAP;
+#endif
 #ifdef USE_UCONTEXT
 typedef struct CONTEXT_STRUCTURE {
     char *stack; /* CPU stack for this thread */
@@ -566,13 +725,59 @@ typedef struct CONTEXT_STRUCTURE {
     ucontext_t context;
     s_poll_set *fds;
     int ready; /* number of ready file descriptors */
+#ifdef USE_UCONTEXT_EPOLL
+    struct timespec finish; /* CLOCK_MONOTONIC deadline */
+    unsigned int timer; /* index in the timer heap + 1, or 0 */
+#else
     time_t finish; /* when to finish poll() for this context */
+#endif
     struct CONTEXT_STRUCTURE *next; /* next context on a list */
     void *tls; /* thread local storage for str.c */
 } CONTEXT;
 extern CONTEXT *ready_head, *ready_tail;
+#ifndef USE_UCONTEXT_EPOLL
 extern CONTEXT *waiting_head, *waiting_tail;
 #endif
+#endif
+#ifdef USE_EPOLL
+typedef struct CONTEXT_STRUCTURE CONTEXT;
+#ifdef USE_IO_URING
+typedef struct URING_STRUCTURE URING; /* defined in network.c */
+#endif
+typedef struct {
+    pthread_t thread;
+    int epfd; /* epoll instance of this reactor */
+#ifdef USE_IO_URING
+    URING *uring; /* io_uring instance used instead of epfd */
+#endif
+    int wakeup[2]; /* pipe used to wake up epoll_wait() */
+    pthread_mutex_t mutex; /* protects the inbox */
+    CONTEXT *inbox_head, *inbox_tail; /* queued by create_client() */
+    CONTEXT *ready_head, *ready_tail; /* ready to execute */
+    TIMER_HEAP timers; /* contexts waiting with a timeout */
+    CONTEXT *current; /* currently executing context */
+    CONTEXT *to_free; /* delayed memory deallocation */
+    ucontext_t scheduler; /* context of the reactor loop */
+    struct epoll_event *events;
+} REACTOR;
+struct CONTEXT_STRUCTURE {
+    char *stack; /* CPU stack for this context */
+    unsigned long id;
+    ucontext_t context;
+    REACTOR *reactor; /* reactor thread executing this context */
+    s_poll_set *fds; /* set with registered descriptors or NULL */
+    int ready; /* number of ready file descriptors */
+    struct timespec finish; /* CLOCK_MONOTONIC deadline */
+    unsigned int timer; /* index in the timer heap + 1, or 0 */
+    struct CONTEXT_STRUCTURE *next; /* next context on a list */
+    void *tls; /* thread local storage for str.c */
+};
+CONTEXT *current_context(void);
+int reactor_count(void);
+int create_context(int, void *(*)(void *), void *, int);
+int reactor_init(REACTOR *);
+void reactor_wait(REACTOR *);
+#endif
 #ifdef _WIN32_WCE
 long _beginthread(void (*)(void *), int, void *);
 void _endthread(void);
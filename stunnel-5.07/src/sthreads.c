@@ -77,7 +77,9 @@ void leave_critical_section(SECTION_CODE i) {
 
 /* first context on the ready list is the active context */
 CONTEXT *ready_head=NULL, *ready_tail=NULL;         /* ready to execute */
+#ifndef USE_UCONTEXT_EPOLL
 CONTEXT *waiting_head=NULL, *waiting_tail=NULL;     /* waiting on poll() */
+#endif
 
 unsigned long stunnel_process_id(void) {
     return (unsigned long)getpid();
@@ -209,7 +211,7 @@ int create_client(int ls, int s, CLI *arg, void *(*cli)(void *)) {
 
 #endif /* USE_FORK */
 
-#ifdef USE_PTHREAD
+#if defined(USE_PTHREAD) || defined(USE_EPOLL)
 
 static pthread_mutex_t stunnel_cs[CRIT_SECTIONS];
 static pthread_mutex_t *lock_cs;
@@ -265,11 +267,7 @@ NOEXPORT void dyn_destroy_function(struct CRYPTO_dynlock_value *value,
     str_free(value);
 }
 
-unsigned long stunnel_process_id(void) {
-    return (unsigned long)getpid();
-}
-
-unsigned long stunnel_thread_id(void) {
+NOEXPORT unsigned long system_thread_id(void) {
 #if defined(SYS_gettid) && defined(__linux__)
     return syscall(SYS_gettid);
 #else
@@ -277,6 +275,10 @@ unsigned long stunnel_thread_id(void) {
 #endif
 }
 
+unsigned long stunnel_process_id(void) {
+    return (unsigned long)getpid();
+}
+
 int sthreads_init(void) {
     int i;
 
@@ -289,7 +291,7 @@ int sthreads_init(void) {
     str_detach(lock_cs); /* do not track this allocation */
     for(i=0; i<CRYPTO_num_locks(); i++)
         pthread_mutex_init(lock_cs+i, NULL);
-    CRYPTO_set_id_callback(stunnel_thread_id);
+    CRYPTO_set_id_callback(system_thread_id);
     CRYPTO_set_locking_callback(locking_callback);
 
     /* initialize OpenSSL dynamic locks callbacks */
@@ -300,7 +302,242 @@ int sthreads_init(void) {
     return 0;
 }
 
+#endif /* USE_PTHREAD || USE_EPOLL */
+
+#ifdef USE_ASYNC_KEYS
+
+/* key worker threads execute private key operations queued by ctx.c */
+static pthread_mutex_t key_mutex=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t key_cond=PTHREAD_COND_INITIALIZER;
+static KEYOP *keyop_head=NULL, *keyop_tail=NULL; /* queued operations */
+static int key_workers=0; /* 0 if the key workers are not started */
+
+NOEXPORT int key_workers_start(void);
+NOEXPORT void *key_worker_thread(void *);
+
+/* return 1 if the operation has to be executed by the caller */
+int keyop_queue(KEYOP *op) {
+    pthread_mutex_lock(&key_mutex);
+    if(!key_workers) {
+        pthread_mutex_unlock(&key_mutex);
+        return 1;
+    }
+    op->pending=1;
+    op->next=NULL;
+    if(keyop_tail)
+        keyop_tail->next=op;
+    else
+        keyop_head=op;
+    keyop_tail=op;
+    pthread_cond_signal(&key_cond);
+    pthread_mutex_unlock(&key_mutex);
+    return 0;
+}
+
+/* a pending operation is released by its key worker */
+void keyop_release(KEYOP *op) {
+    pthread_mutex_lock(&key_mutex);
+    if(op->pending) {
+        op->orphan=1;
+        pthread_mutex_unlock(&key_mutex);
+        return;
+    }
+    pthread_mutex_unlock(&key_mutex);
+    op->cleanup(op);
+}
+
+NOEXPORT int key_workers_start(void) {
+    pthread_t thread;
+    pthread_attr_t pth_attr;
+    int i, error;
+#ifdef HAVE_PTHREAD_SIGMASK
+    sigset_t new_set, old_set;
+#endif /* HAVE_PTHREAD_SIGMASK */
+
+    if(key_workers || !global_options.key_workers)
+        return 0;
+
+#ifdef HAVE_PTHREAD_SIGMASK
+    /* signals are blocked for key worker threads */
+    sigfillset(&new_set);
+    pthread_sigmask(SIG_SETMASK, &new_set, &old_set); /* block signals */
+#endif /* HAVE_PTHREAD_SIGMASK */
+    pthread_attr_init(&pth_attr);
+    pthread_attr_setdetachstate(&pth_attr, PTHREAD_CREATE_DETACHED);
+    for(i=0; i<global_options.key_workers; i++) {
+        error=pthread_create(&thread, &pth_attr, key_worker_thread,
+            (void *)(long)i);
+        if(error) {
+            errno=error;
+            ioerror("pthread_create");
+            break;
+        }
+    }
+    pthread_attr_destroy(&pth_attr);
+#ifdef HAVE_PTHREAD_SIGMASK
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL); /* unblock signals */
+#endif /* HAVE_PTHREAD_SIGMASK */
+
+    pthread_mutex_lock(&key_mutex);
+    key_workers=i;
+    pthread_mutex_unlock(&key_mutex);
+    s_log(LOG_INFO, "%d key worker thread(s) started", i);
+    return 0;
+}
+
+NOEXPORT void *key_worker_thread(void *arg) {
+    KEYOP *op;
+#if defined(__linux__) && defined(CPU_SET)
+    cpu_set_t cpus;
+    long num_cpus;
+    int error;
+
+    /* pin each key worker to its own CPU */
+    num_cpus=sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_cpus>0) {
+        CPU_ZERO(&cpus);
+        CPU_SET((int)((long)arg%num_cpus), &cpus);
+        error=pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus);
+        if(error) {
+            errno=error;
+            ioerror("pthread_setaffinity_np"); /* not fatal */
+        }
+    }
+#else
+    (void)arg; /* skip warning about unused parameter */
+#endif
+
+    pthread_mutex_lock(&key_mutex);
+    for(;;) {
+        while(!keyop_head)
+            pthread_cond_wait(&key_cond, &key_mutex);
+        op=keyop_head;
+        keyop_head=op->next;
+        if(!keyop_head)
+            keyop_tail=NULL;
+        pthread_mutex_unlock(&key_mutex);
+
+        op->func(op);
+
+        pthread_mutex_lock(&key_mutex);
+        op->pending=0;
+        if(op->orphan) { /* nobody waits for the result */
+            pthread_mutex_unlock(&key_mutex);
+            op->cleanup(op);
+            pthread_mutex_lock(&key_mutex);
+        } else if(write(op->wakeup[1], "", 1)!=1) {
+            ioerror("key_worker_thread: write");
+        }
+    }
+    return NULL; /* never reached */
+}
+
+#endif /* USE_ASYNC_KEYS */
+
+#ifdef USE_PTHREAD
+
+/* pre-spawned worker threads execute clients queued by create_client() */
+typedef struct WORK_STRUCTURE {
+    void *(*func)(void *);
+    void *arg;
+    struct WORK_STRUCTURE *next;
+} WORK;
+
+static pthread_mutex_t pool_mutex=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond=PTHREAD_COND_INITIALIZER;
+static WORK *work_head=NULL, *work_tail=NULL; /* queued clients */
+static int work_queued=0; /* number of queued clients */
+static int total_workers=0, idle_workers=0;
+static int pool_stack_size=0; /* 0 if the pool is not started */
+
+NOEXPORT int spawn_thread(void *(*)(void *), void *, int);
+NOEXPORT void *worker_thread(void *);
+
+unsigned long stunnel_thread_id(void) {
+    return system_thread_id();
+}
+
+/* start worker threads after daemonize() */
+int sthreads_start(void) {
+    SERVICE_OPTIONS *opt;
+    int i, stack_size;
+
+    if(pool_stack_size) /* already started */
+        return 0;
+    /* workers need a stack large enough for any configured service */
+    stack_size=DEFAULT_STACK_SIZE;
+    for(opt=service_options.next; opt; opt=opt->next)
+        if(opt->stack_size>stack_size)
+            stack_size=opt->stack_size;
+    pthread_mutex_lock(&pool_mutex);
+    pool_stack_size=stack_size;
+    for(i=0; i<global_options.workers_min; i++) {
+        if(spawn_thread(worker_thread, NULL, pool_stack_size))
+            break;
+        total_workers++;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    s_log(LOG_INFO, "%d worker thread(s) started", i);
+#ifdef USE_ASYNC_KEYS
+    return key_workers_start();
+#else
+    return 0;
+#endif
+}
+
 int create_client(int ls, int s, CLI *arg, void *(*cli)(void *)) {
+    WORK *work;
+    int error;
+
+    (void)ls; /* this parameter is only used with USE_FORK */
+
+    pthread_mutex_lock(&pool_mutex);
+    if(!pool_stack_size || arg->opt->stack_size>pool_stack_size ||
+            !global_options.workers_idle) {
+        /* no suitable workers: use a dedicated thread */
+        pthread_mutex_unlock(&pool_mutex);
+        error=spawn_thread(cli, arg, arg->opt->stack_size);
+    } else {
+        work=str_alloc(sizeof(WORK));
+        str_detach(work); /* released by worker_thread() */
+        work->func=cli;
+        work->arg=arg;
+        work->next=NULL;
+        if(work_tail)
+            work_tail->next=work;
+        else
+            work_head=work;
+        work_tail=work;
+        error=0;
+        if(++work_queued>idle_workers && (!global_options.workers_max ||
+                total_workers<global_options.workers_max)) {
+            error=spawn_thread(worker_thread, NULL, pool_stack_size);
+            if(!error)
+                total_workers++;
+            else if(total_workers) /* it will be served by a busy worker */
+                error=0;
+        }
+        if(!error)
+            pthread_cond_signal(&pool_cond);
+        else { /* no workers at all */
+            work_head=work_tail=NULL;
+            work_queued=0;
+            str_free(work);
+        }
+        pthread_mutex_unlock(&pool_mutex);
+    }
+
+    if(error) {
+        if(arg)
+            str_free(arg);
+        if(s>=0)
+            closesocket(s);
+        return -1;
+    }
+    return 0;
+}
+
+NOEXPORT int spawn_thread(void *(*func)(void *), void *arg, int stack_size) {
     pthread_t thread;
     pthread_attr_t pth_attr;
     int error;
@@ -311,8 +548,6 @@ int create_client(int ls, int s, CLI *arg, void *(*cli)(void *)) {
     sigset_t new_set, old_set;
 #endif /* HAVE_PTHREAD_SIGMASK && !__APPLE__*/
 
-    (void)ls; /* this parameter is only used with USE_FORK */
-
 #if defined(HAVE_PTHREAD_SIGMASK) && !defined(__APPLE__)
     /* the idea is that only the main thread handles all the signals with
      * posix threads;  signals are blocked for any other thread */
@@ -321,8 +556,8 @@ int create_client(int ls, int s, CLI *arg, void *(*cli)(void *)) {
 #endif /* HAVE_PTHREAD_SIGMASK && !__APPLE__*/
     pthread_attr_init(&pth_attr);
     pthread_attr_setdetachstate(&pth_attr, PTHREAD_CREATE_DETACHED);
-    pthread_attr_setstacksize(&pth_attr, arg->opt->stack_size);
-    error=pthread_create(&thread, &pth_attr, cli, arg);
+    pthread_attr_setstacksize(&pth_attr, stack_size);
+    error=pthread_create(&thread, &pth_attr, func, arg);
     pthread_attr_destroy(&pth_attr);
 #if defined(HAVE_PTHREAD_SIGMASK) && !defined(__APPLE__)
     pthread_sigmask(SIG_SETMASK, &old_set, NULL); /* unblock signals */
@@ -331,6 +566,102 @@ int create_client(int ls, int s, CLI *arg, void *(*cli)(void *)) {
     if(error) {
         errno=error;
         ioerror("pthread_create");
+        return -1;
+    }
+    return 0;
+}
+
+NOEXPORT void *worker_thread(void *arg) {
+    WORK *work;
+    void *(*func)(void *);
+    struct timespec deadline;
+
+    (void)arg; /* skip warning about unused parameter */
+    pthread_mutex_lock(&pool_mutex);
+    for(;;) {
+        /* wait for a queued client */
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec+=global_options.workers_idle;
+        idle_workers++;
+        while(!work_head) {
+            if(total_workers<=global_options.workers_min) /* keep it */
+                pthread_cond_wait(&pool_cond, &pool_mutex);
+            else if(pthread_cond_timedwait(&pool_cond, &pool_mutex,
+                    &deadline)==ETIMEDOUT && !work_head &&
+                    total_workers>global_options.workers_min)
+                break;
+        }
+        idle_workers--;
+        if(!work_head) /* idle timeout exceeded */
+            break;
+
+        /* execute the client */
+        work=work_head;
+        work_head=work->next;
+        if(!work_head)
+            work_tail=NULL;
+        work_queued--;
+        pthread_mutex_unlock(&pool_mutex);
+        func=work->func;
+        arg=work->arg;
+        str_free(work);
+        func(arg); /* client_thread() releases its allocations */
+        pthread_mutex_lock(&pool_mutex);
+    }
+    total_workers--;
+    pthread_mutex_unlock(&pool_mutex);
+    return NULL;
+}
+
+#endif /* USE_PTHREAD */
+
+#ifdef USE_EPOLL
+
+/* each reactor thread executes its contexts until they wait for I/O */
+static REACTOR *reactors=NULL;
+static int num_reactors=0;
+static pthread_key_t reactor_key;
+static int reactors_started=0;
+
+NOEXPORT int reactors_init(void);
+NOEXPORT void *reactor_thread(void *);
+
+unsigned long stunnel_thread_id(void) {
+    CONTEXT *context;
+
+    context=current_context();
+    return context ? context->id : system_thread_id();
+}
+
+CONTEXT *current_context(void) {
+    REACTOR *reactor;
+
+    if(!reactors_started)
+        return NULL;
+    reactor=pthread_getspecific(reactor_key);
+    return reactor ? reactor->current : NULL;
+}
+
+int create_client(int ls, int s, CLI *arg, void *(*cli)(void *)) {
+    static int next_reactor=0;
+    int reactor;
+
+    (void)ls; /* this parameter is only used with USE_FORK */
+
+    if(!reactor_count()) {
+        if(arg)
+            str_free(arg);
+        if(s>=0)
+            closesocket(s);
+        return -1;
+    }
+    if(current_context()) { /* accepted by a reactor: serve it locally */
+        reactor=(int)(current_context()->reactor-reactors);
+    } else {
+        reactor=next_reactor;
+        next_reactor=(next_reactor+1)%num_reactors;
+    }
+    if(create_context(reactor, cli, arg, arg->opt->stack_size)) {
         if(arg)
             str_free(arg);
         if(s>=0)
@@ -340,7 +671,185 @@ int create_client(int ls, int s, CLI *arg, void *(*cli)(void *)) {
     return 0;
 }
 
-#endif /* USE_PTHREAD */
+int create_context(int number, void *(*func)(void *), void *arg,
+        int stack_size) {
+    static unsigned long next_id=1;
+    CONTEXT *context;
+    REACTOR *reactor;
+    int wakeup;
+
+    s_log(LOG_DEBUG, "Creating a new context");
+    context=str_alloc(sizeof(CONTEXT));
+    str_detach(context);
+
+    /* initialize context_t structure */
+    if(getcontext(&context->context)<0) {
+        str_free(context);
+        ioerror("getcontext");
+        return -1;
+    }
+    context->context.uc_link=NULL; /* stunnel does not use uc_link */
+    /* only the main thread handles signals */
+    sigfillset(&context->context.uc_sigmask);
+
+    /* create stack */
+    context->stack=str_alloc(stack_size);
+    str_detach(context->stack);
+    context->context.uc_stack.ss_sp=context->stack;
+    context->context.uc_stack.ss_size=stack_size;
+    context->context.uc_stack.ss_flags=0;
+    makecontext(&context->context, (void(*)(void))func, 1, arg);
+
+    /* queue the new context on the selected reactor */
+    reactor=reactors+number;
+    context->reactor=reactor;
+    context->next=NULL;
+    enter_critical_section(CRIT_THREADS);
+    context->id=next_id++;
+    leave_critical_section(CRIT_THREADS);
+    pthread_mutex_lock(&reactor->mutex);
+    wakeup=!reactor->inbox_head; /* otherwise a wakeup is already pending */
+    if(reactor->inbox_tail)
+        reactor->inbox_tail->next=context;
+    else
+        reactor->inbox_head=context;
+    reactor->inbox_tail=context;
+    pthread_mutex_unlock(&reactor->mutex);
+    /* the inbox is always checked before the reactor waits for events */
+    if(current_context() && current_context()->reactor==reactor)
+        wakeup=0;
+    if(wakeup && writesocket(reactor->wakeup[1], "", 1)<0)
+        ioerror("create_context: write");
+    s_log(LOG_DEBUG, "New context %lu queued on reactor %d",
+        context->id, number);
+    return 0;
+}
+
+/* initialize reactors if needed, return the number of reactors */
+int reactor_count(void) {
+    if(!reactors && reactors_init())
+        return 0;
+    return num_reactors;
+}
+
+/* contexts queued before this call are executed once threads are started */
+int sthreads_start(void) {
+    pthread_attr_t pth_attr;
+    int i, error=0;
+#ifdef HAVE_PTHREAD_SIGMASK
+    sigset_t new_set, old_set;
+#endif /* HAVE_PTHREAD_SIGMASK */
+
+    if(reactors_started) /* already started */
+        return 0;
+    if(!reactor_count())
+        return 1;
+
+#ifdef HAVE_PTHREAD_SIGMASK
+    /* signals are blocked for reactor threads */
+    sigfillset(&new_set);
+    pthread_sigmask(SIG_SETMASK, &new_set, &old_set); /* block signals */
+#endif /* HAVE_PTHREAD_SIGMASK */
+    pthread_attr_init(&pth_attr);
+    pthread_attr_setdetachstate(&pth_attr, PTHREAD_CREATE_DETACHED);
+    reactors_started=1; /* needed by current_context() in reactor threads */
+    for(i=0; i<num_reactors; i++) {
+        error=pthread_create(&reactors[i].thread, &pth_attr,
+            reactor_thread, reactors+i);
+        if(error) {
+            errno=error;
+            ioerror("pthread_create");
+            break;
+        }
+    }
+    pthread_attr_destroy(&pth_attr);
+#ifdef HAVE_PTHREAD_SIGMASK
+    pthread_sigmask(SIG_SETMASK, &old_set, NULL); /* unblock signals */
+#endif /* HAVE_PTHREAD_SIGMASK */
+
+    if(i<num_reactors) { /* contexts of this reactor would never execute */
+        s_log(LOG_ERR, "Cannot start reactor threads");
+        return 1;
+    }
+    s_log(LOG_INFO, "%d reactor thread(s) started", num_reactors);
+#ifdef USE_ASYNC_KEYS
+    return key_workers_start();
+#else
+    return 0;
+#endif
+}
+
+NOEXPORT int reactors_init(void) {
+    REACTOR *table;
+    int i;
+
+    num_reactors=global_options.reactors;
+    if(num_reactors<=0) /* one reactor per CPU */
+        num_reactors=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_reactors<=0)
+        num_reactors=1;
+    table=str_alloc(num_reactors*sizeof(REACTOR));
+    str_detach(table); /* do not track this allocation */
+    pthread_key_create(&reactor_key, NULL);
+    for(i=0; i<num_reactors; i++) {
+        pthread_mutex_init(&table[i].mutex, NULL);
+        if(reactor_init(table+i))
+            break;
+    }
+    if(!i) {
+        s_log(LOG_ERR, "Cannot initialize reactors");
+        str_free(table);
+        return 1;
+    }
+    num_reactors=i; /* reactors that were successfully initialized */
+    reactors=table;
+    return 0;
+}
+
+NOEXPORT void *reactor_thread(void *arg) {
+    REACTOR *reactor=arg;
+    CONTEXT *context;
+
+    pthread_setspecific(reactor_key, reactor);
+    for(;;) {
+        /* move contexts queued by create_client() to the ready queue */
+        pthread_mutex_lock(&reactor->mutex);
+        if(reactor->inbox_head) {
+            if(reactor->ready_tail)
+                reactor->ready_tail->next=reactor->inbox_head;
+            else
+                reactor->ready_head=reactor->inbox_head;
+            reactor->ready_tail=reactor->inbox_tail;
+            reactor->inbox_head=reactor->inbox_tail=NULL;
+        }
+        pthread_mutex_unlock(&reactor->mutex);
+
+        if(!reactor->ready_head) { /* nothing to execute */
+            reactor_wait(reactor); /* wait for I/O or timeouts */
+            continue;
+        }
+
+        /* execute ready contexts until they wait in s_poll_wait() */
+        while(reactor->ready_head) {
+            context=reactor->ready_head;
+            reactor->ready_head=context->next;
+            if(!reactor->ready_head) /* the queue is empty */
+                reactor->ready_tail=NULL;
+            reactor->current=context;
+            swapcontext(&reactor->scheduler, &context->context);
+            reactor->current=NULL;
+            /* it's illegal to deallocate the stack of the current context */
+            if(reactor->to_free) { /* a delayed deallocation is scheduled */
+                str_free(reactor->to_free->stack);
+                str_free(reactor->to_free);
+                reactor->to_free=NULL;
+            }
+        }
+    }
+    return NULL;
+}
+
+#endif /* USE_EPOLL */
 
 #ifdef USE_WIN32
 
@@ -204,6 +204,37 @@ NOEXPORT ALLOC_TLS *get_alloc_tls() {
 
 #endif /* USE_PTHREAD */
 
+#ifdef USE_EPOLL
+
+static pthread_key_t pthread_key;
+
+void str_init() {
+    pthread_key_create(&pthread_key, NULL);
+    str_initialized=1;
+}
+
+NOEXPORT void set_alloc_tls(ALLOC_TLS *tls) {
+    CONTEXT *context;
+
+    context=current_context();
+    if(context)
+        context->tls=tls;
+    else /* not running on a reactor thread */
+        pthread_setspecific(pthread_key, tls);
+}
+
+NOEXPORT ALLOC_TLS *get_alloc_tls() {
+    CONTEXT *context;
+
+    context=current_context();
+    if(context)
+        return context->tls;
+    else /* not running on a reactor thread */
+        return pthread_getspecific(pthread_key);
+}
+
+#endif /* USE_EPOLL */
+
 #ifdef USE_WIN32
 
 static DWORD tls_index;
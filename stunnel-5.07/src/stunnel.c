@@ -64,7 +64,19 @@ struct sockaddr_un {
 };
 #endif
 
-NOEXPORT int accept_connection(SERVICE_OPTIONS *);
+NOEXPORT int accept_connections(SERVICE_OPTIONS *, int);
+NOEXPORT int accept_connection(SERVICE_OPTIONS *, int);
+NOEXPORT int accept_spare(SERVICE_OPTIONS *, int);
+NOEXPORT void overload_shed(SERVICE_OPTIONS *, int);
+NOEXPORT void overload_stats(SERVICE_OPTIONS *);
+NOEXPORT int overload_backoff(int);
+NOEXPORT int service_timers(void);
+NOEXPORT void listen_slot(SERVICE_OPTIONS *, int);
+NOEXPORT void listen_slots_want(int);
+#ifdef USE_EPOLL
+NOEXPORT int bind_reuseport(SERVICE_OPTIONS *);
+NOEXPORT void *reactor_listener(void *);
+#endif
 #ifdef HAVE_CHROOT
 NOEXPORT int change_root(void);
 #endif
@@ -84,6 +96,13 @@ int max_clients=0;
 volatile int num_clients=-1;
 #endif
 s_poll_set *fds; /* file descriptors of listening sockets */
+/* services of fds slots (NULL for the signal pipe) */
+static SERVICE_OPTIONS **slot_service=NULL;
+static int slot_services=0, allocated_slot_services=0;
+#ifndef USE_WIN32
+/* released to accept and shed a connection when out of descriptors */
+static int spare_fd=-1;
+#endif
 int systemd_fds; /* number of file descriptors passed by systemd */
 int listen_fds_start; /* base for systemd-provided file descriptors */
 
@@ -116,6 +135,13 @@ void main_init() { /* one-time initialization */
     get_limits(); /* required by setup_fd() */
 #endif
     fds=s_poll_alloc();
+#ifndef USE_WIN32
+    spare_fd=open("/dev/null", O_RDONLY);
+#ifdef FD_CLOEXEC
+    if(spare_fd>=0)
+        fcntl(spare_fd, F_SETFD, FD_CLOEXEC);
+#endif
+#endif
     if(signal_pipe_init())
         fatal("Signal pipe initialization failed: "
             "check your personal firewall");
@@ -194,6 +220,17 @@ void main_cleanup() {
     unbind_ports();
     s_poll_free(fds);
     fds=NULL;
+    if(slot_service) {
+        str_free(slot_service);
+        slot_service=NULL;
+        allocated_slot_services=0;
+    }
+#ifndef USE_WIN32
+    if(spare_fd>=0) {
+        close(spare_fd);
+        spare_fd=-1;
+    }
+#endif
 #if 0
     str_stats(); /* main thread allocation tracking */
 #endif
@@ -263,50 +300,143 @@ void child_status(void) { /* dead libwrap or 'exec' process detected */
 
 void daemon_loop(void) {
     SERVICE_OPTIONS *opt;
-    int temporary_lack_of_resources;
+    int temporary_lack_of_resources, slot, delay=0;
 
+#if defined(USE_PTHREAD) || defined(USE_EPOLL)
+    /* threads created before daemonize() would not survive fork() */
+    if(sthreads_start())
+        fatal("Failed to start threads");
+#endif
     while(1) {
         temporary_lack_of_resources=0;
-        if(s_poll_wait(fds, -1, -1)>=0) {
+        if(s_poll_wait(fds, service_timers(), 0)>=0) {
             if(s_poll_canread(fds, signal_pipe[0]))
                 if(signal_pipe_dispatch()) /* received SIGNAL_TERMINATE */
                     break; /* terminate daemon_loop */
-            for(opt=service_options.next; opt; opt=opt->next)
-                if(opt->option.accept && s_poll_canread(fds, opt->fd))
-                    if(accept_connection(opt))
+            /* listening sockets are looked up by slot, not by service */
+            for(slot=0; slot<slot_services; slot++) {
+                opt=slot_service[slot];
+                if(opt && s_poll_slot_canread(fds, slot))
+                    if(accept_connections(opt, opt->fd))
                         temporary_lack_of_resources=1;
+            }
         } else {
             log_error(LOG_NOTICE, get_last_socket_error(),
                 "daemon_loop: s_poll_wait");
             temporary_lack_of_resources=1;
         }
         if(temporary_lack_of_resources) {
-            s_log(LOG_NOTICE,
-                "Accepting new connections suspended for 1 second");
-            sleep(1); /* to avoid log trashing */
+            delay=overload_backoff(delay);
+            /* only wait for signals until the delay expires */
+            listen_slots_want(0);
+            s_poll_wait(fds, delay/1000, delay%1000);
+            listen_slots_want(1);
+        } else if(delay) {
+            s_log(LOG_NOTICE, "Accepting new connections resumed");
+            for(opt=service_options.next; opt; opt=opt->next)
+                if(opt->option.accept)
+                    overload_stats(opt);
+            delay=0;
+        }
+    }
+}
+
+/* run due periodic tasks of services, return seconds to the next or -1 */
+NOEXPORT int service_timers(void) {
+    SERVICE_OPTIONS *opt;
+    time_t now=time(NULL);
+    long left, next=-1;
+
+    for(opt=service_options.next; opt; opt=opt->next) {
+        if(opt->session_file) {
+            left=(long)(opt->session_file_saved+opt->session_file_interval-now);
+            if(left<=0) {
+                session_file_save(opt);
+                left=opt->session_file_interval;
+            }
+            if(next<0 || left<next)
+                next=left;
+        }
+        if(opt->buffer_release) {
+            left=idle_release_timer(opt);
+            if(next<0 || left<next)
+                next=left;
         }
+#ifndef OPENSSL_NO_TLSEXT
+        if(opt->ticket_keys) {
+            left=ticket_keys_timer(opt);
+            if(next<0 || left<next)
+                next=left;
+        }
+#endif
+#ifdef USE_OCSP_STAPLING
+        if(opt->ocsp_staple) {
+            left=ocsp_staple_timer(opt);
+            if(next<0 || left<next)
+                next=left;
+        }
+#endif
+    }
+    return (int)next;
+}
+
+#define OVERLOAD_DELAY_MIN 10
+#define OVERLOAD_DELAY_MAX 1000
+
+/* return the next adaptive delay (in milliseconds) of suspended accepts */
+NOEXPORT int overload_backoff(int delay) {
+    if(!delay) {
+        s_log(LOG_NOTICE, "Accepting new connections suspended");
+        return OVERLOAD_DELAY_MIN;
     }
+    delay*=2;
+    return delay<OVERLOAD_DELAY_MAX ? delay : OVERLOAD_DELAY_MAX;
 }
 
+    /* drain up to acceptBatch pending connections on a single wakeup */
     /* return 1 when a short delay is needed before another try */
-NOEXPORT int accept_connection(SERVICE_OPTIONS *opt) {
+NOEXPORT int accept_connections(SERVICE_OPTIONS *opt, int fd) {
+    int i;
+
+    for(i=0; i<global_options.accept_batch; i++)
+        switch(accept_connection(opt, fd)) {
+        case -1: /* no more pending connections */
+            return 0;
+        case 1: /* temporary lack of resources */
+            return 1;
+        }
+    return 0;
+}
+
+    /* return 1 when a short delay is needed before another try */
+    /* return -1 when no connection is pending */
+NOEXPORT int accept_connection(SERVICE_OPTIONS *opt, int fd) {
     SOCKADDR_UNION addr;
     char *from_address;
     int s;
+    unsigned long shed;
     socklen_t addrlen;
 
     addrlen=sizeof addr;
     for(;;) {
-        s=s_accept(opt->fd, &addr.sa, &addrlen, 1, "local socket");
+        s=s_accept(fd, &addr.sa, &addrlen, 1, "local socket");
         if(s>=0) /* success! */
             break;
         switch(get_last_socket_error()) {
             case S_EINTR: /* interrupted by a signal */
                 break; /* retry now */
+            case S_EWOULDBLOCK: /* the accept queue is empty */
+#if S_EAGAIN!=S_EWOULDBLOCK
+            case S_EAGAIN:
+#endif
+                return -1;
             case S_EMFILE:
 #ifdef S_ENFILE
             case S_ENFILE:
 #endif
+                if(opt->overload!=OVERLOAD_PAUSE)
+                    return accept_spare(opt, fd);
+                return 1; /* temporary lack of resources */
 #ifdef S_ENOBUFS
             case S_ENOBUFS:
 #endif
@@ -326,13 +456,25 @@ NOEXPORT int accept_connection(SERVICE_OPTIONS *opt) {
     RAND_add("", 1, 0.0); /* each child needs a unique entropy pool */
 #else
     if(max_clients && num_clients>=max_clients) {
-        s_log(LOG_WARNING, "Connection rejected: too many clients (>=%d)",
-            max_clients);
-        closesocket(s);
+        s_log(LOG_DEBUG, "Too many clients (>=%d)", max_clients);
+        overload_shed(opt, s);
         return 0;
     }
 #endif
-    if(create_client(opt->fd, s,
+    enter_critical_section(CRIT_ACCEPT);
+    opt->accepted++;
+    if(opt->overloaded) {
+        opt->overloaded=0;
+        shed=opt->shed-opt->shed_before;
+        leave_critical_section(CRIT_ACCEPT);
+        s_log(LOG_NOTICE,
+            "Service [%s] recovered from overload: %lu connection(s) shed",
+            opt->servname, shed);
+        overload_stats(opt);
+    } else {
+        leave_critical_section(CRIT_ACCEPT);
+    }
+    if(create_client(fd, s,
             alloc_client_session(opt, s, s), client_thread)) {
         s_log(LOG_ERR, "Connection rejected: create_client failed");
         closesocket(s);
@@ -341,20 +483,162 @@ NOEXPORT int accept_connection(SERVICE_OPTIONS *opt) {
     return 0;
 }
 
+    /* accept a connection with the spare descriptor and shed it */
+    /* return values are the same as for accept_connection() */
+NOEXPORT int accept_spare(SERVICE_OPTIONS *opt, int fd) {
+#ifdef USE_WIN32
+    (void)opt; /* skip warning about unused parameter */
+    (void)fd; /* skip warning about unused parameter */
+    return 1; /* no spare descriptor */
+#else
+    int s;
+
+    enter_critical_section(CRIT_ACCEPT);
+    if(spare_fd<0) { /* failed to reopen the spare descriptor */
+        spare_fd=open("/dev/null", O_RDONLY);
+        if(spare_fd<0) {
+            leave_critical_section(CRIT_ACCEPT);
+            return 1;
+        }
+#ifdef FD_CLOEXEC
+        fcntl(spare_fd, F_SETFD, FD_CLOEXEC);
+#endif
+    }
+    close(spare_fd);
+    s=s_accept(fd, NULL, NULL, 1, "local socket");
+    spare_fd=open("/dev/null", O_RDONLY);
+#ifdef FD_CLOEXEC
+    if(spare_fd>=0)
+        fcntl(spare_fd, F_SETFD, FD_CLOEXEC);
+#endif
+    leave_critical_section(CRIT_ACCEPT);
+    if(s<0) /* -1 when the accept queue is empty */
+        return get_last_socket_error()==S_EWOULDBLOCK ||
+            get_last_socket_error()==S_EAGAIN ? -1 : 1;
+    s_log(LOG_DEBUG, "Out of file descriptors");
+    overload_shed(opt, s);
+    return 0;
+#endif
+}
+
+    /* close a connection rejected by an overloaded service */
+NOEXPORT void overload_shed(SERVICE_OPTIONS *opt, int s) {
+    struct linger l;
+    int first;
+
+    if(opt->overload==OVERLOAD_RESET) { /* send RST instead of FIN */
+        l.l_onoff=1;
+        l.l_linger=0;
+        if(setsockopt(s, SOL_SOCKET, SO_LINGER, (void *)&l, sizeof l))
+            sockerror("setsockopt SO_LINGER");
+    }
+    closesocket(s);
+    enter_critical_section(CRIT_ACCEPT);
+    opt->shed++;
+    first=!opt->overloaded;
+    if(first)
+        opt->shed_before=opt->shed-1;
+    opt->overloaded=1;
+    leave_critical_section(CRIT_ACCEPT);
+    if(first) /* only log the beginning of each overload */
+        s_log(LOG_WARNING, "Service [%s] overloaded: %s new connections",
+            opt->servname,
+            opt->overload==OVERLOAD_RESET ? "resetting" : "rejecting");
+}
+
+/* log the connection counters of a listening service */
+NOEXPORT void overload_stats(SERVICE_OPTIONS *opt) {
+    unsigned long accepted, shed;
+
+    enter_critical_section(CRIT_ACCEPT);
+    accepted=opt->accepted;
+    shed=opt->shed;
+    leave_critical_section(CRIT_ACCEPT);
+    s_log(LOG_INFO, "Service [%s]: %lu connection(s) accepted, %lu shed",
+        opt->servname, accepted, shed);
+}
+
+#ifdef USE_EPOLL
+
+typedef struct {
+    SERVICE_OPTIONS *opt;
+    int fd;
+} REACTOR_LISTENER;
+
+/* accept connections on a SO_REUSEPORT socket owned by a reactor */
+NOEXPORT void *reactor_listener(void *arg) {
+    REACTOR_LISTENER *listener=arg;
+    s_poll_set *listen_fds;
+    int slot, delay=0;
+
+    s_log(LOG_DEBUG, "Service [%s] accepting on reactor (FD=%d)",
+        listener->opt->servname, listener->fd);
+    listen_fds=s_poll_alloc();
+    s_poll_init(listen_fds);
+    slot=s_poll_slot(listen_fds, listener->fd); /* registered once */
+    for(;;) {
+        s_poll_reset(listen_fds);
+        s_poll_want(listen_fds, slot, 1, 0);
+        s_poll_wait(listen_fds, -1, -1);
+        if(s_poll_slot_hup(listen_fds, slot)) /* shut down by unbind_ports() */
+            break;
+        if(accept_connections(listener->opt, listener->fd)) {
+            delay=overload_backoff(delay);
+            s_poll_reset(listen_fds);
+            /* only this context is suspended */
+            s_poll_wait(listen_fds, delay/1000, delay%1000);
+        } else if(delay) {
+            s_log(LOG_NOTICE, "Accepting new connections resumed");
+            overload_stats(listener->opt);
+            delay=0;
+        }
+    }
+    s_poll_free(listen_fds); /* unregister before closing */
+    closesocket(listener->fd);
+    s_log(LOG_DEBUG, "Service [%s] closed (FD=%d)",
+        listener->opt->servname, listener->fd);
+    str_free(listener);
+    str_stats(); /* listener allocation tracking */
+    str_cleanup();
+    s_poll_wait(NULL, 0, 0); /* drop the context */
+    return NULL;
+}
+
+#endif /* USE_EPOLL */
+
 /**************************************** initialization helpers */
 
 /* clear fds, close old ports */
 void unbind_ports(void) {
     SERVICE_OPTIONS *opt;
+#ifdef USE_EPOLL
+    int i, n;
+#endif
 #ifdef HAVE_STRUCT_SOCKADDR_UN
     struct stat st; /* buffer for stat */
 #endif
 
     s_poll_init(fds);
-    s_poll_add(fds, signal_pipe[0], 1, 0);
+    slot_services=0;
+    listen_slot(NULL, signal_pipe[0]);
 
     for(opt=service_options.next; opt; opt=opt->next) {
         s_log(LOG_DEBUG, "Closing service [%s]", opt->servname);
+        if(opt->option.accept)
+            overload_stats(opt);
+        if(opt->released)
+            idle_release_stats(opt);
+#ifdef USE_EPOLL
+        if(opt->reactor_fds) {
+            n=reactor_count();
+            /* wake up reactor_listener() contexts, they close the sockets */
+            for(i=0; i<n; i++)
+                if(opt->reactor_fds[i]>=0)
+                    shutdown(opt->reactor_fds[i], SHUT_RDWR);
+            str_free(opt->reactor_fds);
+            opt->reactor_fds=NULL;
+        }
+#endif
         if(opt->option.accept && opt->fd>=0) {
             if(opt->fd<listen_fds_start ||
                     opt->fd>=listen_fds_start+systemd_fds)
@@ -382,6 +666,8 @@ void unbind_ports(void) {
             /*        is it better to kill the service? */
             opt->option.retry=0;
         }
+        if(opt->session_file && opt->ctx) /* before the cache is purged */
+            session_file_save(opt);
         /* purge session cache of the old SSL_CTX object */
         /* this workaround won't be needed anymore after */
         /* delayed deallocation calls SSL_CTX_free()     */
@@ -407,16 +693,39 @@ int bind_ports(void) {
 #endif /* USE_LIBWRAP */
 
     s_poll_init(fds);
-    s_poll_add(fds, signal_pipe[0], 1, 0);
+    slot_services=0;
+    listen_slot(NULL, signal_pipe[0]);
 
     /* allow clean unbind_ports() even though
        bind_ports() was not fully performed */
     for(opt=service_options.next; opt; opt=opt->next)
-        if(opt->option.accept)
+        if(opt->option.accept) {
             opt->fd=-1;
+#ifdef USE_EPOLL
+            opt->reactor_fds=NULL;
+#endif
+        }
+
+    /* loaded here rather than in context_init(), so that on reload
+       the sessions saved by unbind_ports() are already available */
+    for(opt=service_options.next; opt; opt=opt->next)
+        if(opt->session_file && opt->ctx) {
+            session_file_load(opt);
+            opt->session_file_saved=time(NULL);
+        }
 
     listening_section=0;
     for(opt=service_options.next; opt; opt=opt->next) {
+#ifdef USE_EPOLL
+        if(opt->option.accept && opt->option.reuseport &&
+                listening_section>=systemd_fds &&
+                opt->local_addr.sa.sa_family!=AF_UNIX) {
+            if(bind_reuseport(opt))
+                return 1;
+            ++listening_section;
+            continue;
+        }
+#endif
         if(opt->option.accept) {
             if(listening_section<systemd_fds) {
                 opt->fd=listen_fds_start+listening_section;
@@ -457,7 +766,7 @@ int bind_ports(void) {
                     return 1;
                 }
             }
-            s_poll_add(fds, opt->fd, 1, 0);
+            listen_slot(opt, opt->fd);
             s_log(LOG_DEBUG, "Service [%s] (FD=%d) bound to %s",
                 opt->servname, opt->fd, local_address);
             str_free(local_address);
@@ -478,6 +787,102 @@ int bind_ports(void) {
     return 0; /* OK */
 }
 
+/* poll a listening socket and remember its service for daemon_loop() */
+NOEXPORT void listen_slot(SERVICE_OPTIONS *opt, int fd) {
+    int slot;
+
+    slot=s_poll_slot(fds, fd);
+    s_poll_want(fds, slot, 1, 0);
+    if(slot>=allocated_slot_services) {
+        allocated_slot_services=slot+16;
+        slot_service=str_realloc(slot_service,
+            allocated_slot_services*sizeof(SERVICE_OPTIONS *));
+        str_detach(slot_service);
+    }
+    slot_service[slot]=opt;
+    if(slot>=slot_services)
+        slot_services=slot+1;
+}
+
+/* enable either all fds slots or only the signal pipe */
+NOEXPORT void listen_slots_want(int listening) {
+    int slot;
+
+    s_poll_reset(fds);
+    for(slot=0; slot<slot_services; slot++)
+        if(listening || !slot_service[slot])
+            s_poll_want(fds, slot, 1, 0);
+}
+
+#ifdef USE_EPOLL
+
+/* bind a separate SO_REUSEPORT socket for each reactor thread */
+NOEXPORT int bind_reuseport(SERVICE_OPTIONS *opt) {
+    REACTOR_LISTENER *listener;
+    char *local_address;
+    int i, n, on=1;
+
+    n=reactor_count();
+    if(!n)
+        return 1;
+    opt->reactor_fds=str_alloc(n*sizeof(int));
+    for(i=0; i<n; i++)
+        opt->reactor_fds[i]=-1;
+    local_address=s_ntop(&opt->local_addr, addr_len(&opt->local_addr));
+    for(i=0; i<n; i++) {
+        opt->reactor_fds[i]=s_socket(opt->local_addr.sa.sa_family,
+            SOCK_STREAM, 0, 1, "accept socket");
+        if(opt->reactor_fds[i]<0)
+            break;
+        if(set_socket_options(opt->reactor_fds[i], 0)<0)
+            break;
+        if(setsockopt(opt->reactor_fds[i], SOL_SOCKET, SO_REUSEPORT,
+                (void *)&on, sizeof on)) {
+            sockerror("setsockopt SO_REUSEPORT");
+            break;
+        }
+        if(bind(opt->reactor_fds[i],
+                &opt->local_addr.sa, addr_len(&opt->local_addr))) {
+            s_log(LOG_ERR, "Error binding service [%s] to %s",
+                opt->servname, local_address);
+            sockerror("bind");
+            break;
+        }
+        if(listen(opt->reactor_fds[i], SOMAXCONN)) {
+            sockerror("listen");
+            break;
+        }
+    }
+    if(i<n) { /* failed */
+        for(i=0; i<n; i++)
+            if(opt->reactor_fds[i]>=0)
+                closesocket(opt->reactor_fds[i]);
+        str_free(opt->reactor_fds);
+        opt->reactor_fds=NULL;
+        str_free(local_address);
+        return 1;
+    }
+
+    /* each listening socket is closed by its reactor_listener() context */
+    for(i=0; i<n; i++) {
+        listener=str_alloc(sizeof(REACTOR_LISTENER));
+        str_detach(listener);
+        listener->opt=opt;
+        listener->fd=opt->reactor_fds[i];
+        if(create_context(i, reactor_listener, listener, opt->stack_size)) {
+            str_free(listener);
+            closesocket(opt->reactor_fds[i]);
+            opt->reactor_fds[i]=-1;
+        }
+    }
+    s_log(LOG_DEBUG, "Service [%s] bound to %s on %d reactor(s)",
+        opt->servname, local_address, n);
+    str_free(local_address);
+    return 0;
+}
+
+#endif /* USE_EPOLL */
+
 #ifdef HAVE_CHROOT
 NOEXPORT int change_root(void) {
     if(!global_options.chroot_dir)
@@ -559,7 +964,7 @@ NOEXPORT int signal_pipe_dispatch(void) {
             s_log(LOG_DEBUG, "Processing SIGCHLD");
 #ifdef USE_FORK
             client_status(); /* report status of client process */
-#else /* USE_UCONTEXT || USE_PTHREAD */
+#else /* USE_UCONTEXT || USE_PTHREAD || USE_EPOLL */
             child_status();  /* report status of libwrap or 'exec' process */
 #endif /* defined USE_FORK */
             break;
@@ -624,6 +1029,9 @@ void stunnel_info(int level) {
 #ifdef USE_FORK
         "FORK"
 #endif
+#ifdef USE_EPOLL
+        "EPOLL"
+#endif
 
         " Sockets:"
 #ifdef USE_POLL
@@ -631,6 +1039,9 @@ void stunnel_info(int level) {
 #else /* defined(USE_POLL) */
         "SELECT"
 #endif /* defined(USE_POLL) */
+#ifdef USE_IO_URING
+        ",IO_URING"
+#endif /* USE_IO_URING */
         ",IPv%c"
 #ifdef USE_SYSTEMD
         ",SYSTEMD"
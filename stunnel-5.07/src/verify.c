@@ -53,7 +53,26 @@ NOEXPORT int compare_pubkeys(X509 *, X509 *);
 NOEXPORT int crl_check(X509_STORE_CTX *);
 #ifdef HAVE_OSSL_OCSP_H
 NOEXPORT int ocsp_check(X509_STORE_CTX *);
-NOEXPORT OCSP_RESPONSE *ocsp_get_response(CLI *, OCSP_REQUEST *);
+NOEXPORT int ocsp_status(CLI *, OCSP_CERTID *);
+NOEXPORT int ocsp_wait(CLI *, struct OCSP_ENTRY_STRUCTURE *);
+NOEXPORT struct OCSP_ENTRY_STRUCTURE *ocsp_cache_find(SERVICE_OPTIONS *,
+    const unsigned char *, int);
+NOEXPORT struct OCSP_ENTRY_STRUCTURE *ocsp_cache_new(SERVICE_OPTIONS *,
+    OCSP_CERTID *, unsigned char *, int);
+NOEXPORT void ocsp_cache_update(struct OCSP_ENTRY_STRUCTURE *,
+    OCSP_RESPONSE *, int, int, time_t, time_t);
+#ifndef USE_FORK
+NOEXPORT void ocsp_refresh(SERVICE_OPTIONS *);
+NOEXPORT void *ocsp_refresh_thread(void *);
+#endif
+NOEXPORT int ocsp_fetch(CLI *, struct OCSP_ENTRY_STRUCTURE *, int *, int *);
+NOEXPORT OCSP_RESPONSE *ocsp_get_response(CLI *, SOCKADDR_UNION *, char *,
+    OCSP_REQUEST *);
+#ifdef USE_OCSP_STAPLING
+NOEXPORT X509 *ocsp_staple_issuer(SERVICE_OPTIONS *, X509 *);
+NOEXPORT int ocsp_staple_cb(SSL *, void *);
+#endif
+NOEXPORT time_t ocsp_time(ASN1_GENERALIZEDTIME *, time_t);
 #endif
 
 /* utility functions */
@@ -415,19 +434,37 @@ NOEXPORT int crl_check(X509_STORE_CTX *callback_ctx) {
 /**************************************** OCSP checking */
 /* TODO: check OCSP server specified in the certificate */
 
+/* responses are cached per service (keyed by the DER-encoded OCSP_CERTID)
+ * until their nextUpdate, so concurrent handshakes share a single query,
+ * and entries are refreshed in the background before they expire */
+
+typedef struct OCSP_WAITER_STRUCTURE {
+    struct OCSP_WAITER_STRUCTURE *next;
+    int fd[2];                                /* wakeup socket pair */
+    int woken;
+} OCSP_WAITER;
+
+typedef struct OCSP_ENTRY_STRUCTURE {
+    struct OCSP_ENTRY_STRUCTURE *next;
+    unsigned char *id;                             /* DER-encoded certID */
+    int id_len;
+    OCSP_CERTID *cert_id;
+    unsigned char *response;   /* DER-encoded response, NULL if not valid */
+    int response_len;
+    int status, reason;                      /* status of the certificate */
+    time_t expire, refresh;
+    int pending, queued;              /* query in flight, refresh queued */
+    int staple;                 /* response for the local certificate */
+    OCSP_WAITER *waiters;            /* handshakes waiting for the query */
+} OCSP_ENTRY;
+
 NOEXPORT int ocsp_check(X509_STORE_CTX *callback_ctx) {
     SSL *ssl;
     CLI *c;
-    int error, retval=0;
+    int retval=0;
     X509 *cert;
     X509 *issuer=NULL;
-    OCSP_CERTID *certID;
-    OCSP_REQUEST *request=NULL;
-    OCSP_RESPONSE *response=NULL;
-    OCSP_BASICRESP *basicResponse=NULL;
-    ASN1_GENERALIZEDTIME *revoked_at=NULL,
-        *this_update=NULL, *next_update=NULL;
-    int status, reason;
+    OCSP_CERTID *certID=NULL;
 
     ssl=X509_STORE_CTX_get_ex_data(callback_ctx,
         SSL_get_ex_data_X509_STORE_CTX_idx());
@@ -447,6 +484,299 @@ NOEXPORT int ocsp_check(X509_STORE_CTX *callback_ctx) {
         sslerror("OCSP: OCSP_cert_to_id");
         goto cleanup;
     }
+    retval=ocsp_status(c, certID);
+cleanup:
+    if(issuer)
+        X509_free(issuer);
+    if(certID)
+        OCSP_CERTID_free(certID);
+    return retval;
+}
+
+/* find or retrieve the status of the certificate */
+NOEXPORT int ocsp_status(CLI *c, OCSP_CERTID *certID) {
+    OCSP_ENTRY *entry;
+    unsigned char *id, *id_tmp;
+    int id_len, status=0, reason=0, found=0, owner=0, waited=0;
+#ifndef USE_FORK
+    int refresh=0;
+#endif
+
+    id_len=i2d_OCSP_CERTID(certID, NULL);
+    if(id_len<=0) {
+        sslerror("OCSP: i2d_OCSP_CERTID");
+        return 0; /* reject */
+    }
+    id_tmp=id=str_alloc(id_len);
+    i2d_OCSP_CERTID(certID, &id_tmp);
+
+    enter_critical_section(CRIT_OCSP);
+    for(;;) {
+        entry=ocsp_cache_find(c->opt, id, id_len);
+        if(entry && entry->response && time(NULL)<entry->expire) {
+            found=1;
+            status=entry->status;
+            reason=entry->reason;
+#ifndef USE_FORK
+            if(!entry->pending && time(NULL)>=entry->refresh) {
+                entry->pending=entry->queued=1;
+                refresh=1;
+            }
+#endif
+            break;
+        }
+        if(waited) /* the query we waited for has failed */
+            break;
+        if(!entry || !entry->pending) { /* query the responder ourselves */
+            if(!entry)
+                entry=ocsp_cache_new(c->opt, certID, id, id_len);
+            entry->pending=1;
+            owner=1;
+            break;
+        }
+        waited=1;
+        if(ocsp_wait(c, entry)) /* leaves and reenters the section */
+            break;
+    }
+    leave_critical_section(CRIT_OCSP);
+    str_free(id);
+
+    if(found) {
+        s_log(LOG_INFO, "OCSP: Status: %d: %s (cached)",
+            status, OCSP_cert_status_str(status));
+#ifndef USE_FORK
+        if(refresh)
+            ocsp_refresh(c->opt);
+#endif
+    } else if(owner) {
+        /* the pending entry is not evicted until ocsp_fetch() returns */
+        if(!ocsp_fetch(c, entry, &status, &reason))
+            return 0; /* reject */
+    } else {
+        s_log(LOG_WARNING, "OCSP: No valid response");
+        return 0; /* reject */
+    }
+
+    if(status==V_OCSP_CERTSTATUS_REVOKED) {
+        if(reason==-1)
+            s_log(LOG_WARNING, "OCSP: Certificate revoked");
+        else
+            s_log(LOG_WARNING, "OCSP: Certificate revoked: %d: %s",
+                reason, OCSP_crl_reason_str(reason));
+        return 0; /* reject */
+    }
+    return 1; /* success */
+}
+
+/* wait for a query performed by another handshake */
+/* called and returns inside CRIT_OCSP, returns 1 on error */
+NOEXPORT int ocsp_wait(CLI *c, OCSP_ENTRY *entry) {
+    OCSP_WAITER waiter, **ptr;
+    s_poll_set *fds;
+    int err;
+
+    if(make_sockets(waiter.fd))
+        return 1; /* error */
+    waiter.woken=0;
+    waiter.next=entry->waiters;
+    entry->waiters=&waiter;
+    leave_critical_section(CRIT_OCSP);
+
+    s_log(LOG_DEBUG, "OCSP: Waiting for a pending query");
+    /* a private set: the slots of c->fds are kept by transfer() */
+    fds=s_poll_alloc();
+    s_poll_init(fds);
+    s_poll_add(fds, waiter.fd[0], 1, 0);
+    err=s_poll_wait(fds, c->opt->timeout_busy, 0);
+    s_poll_free(fds);
+    if(err==-1)
+        sockerror("OCSP: s_poll_wait");
+    if(err==0)
+        s_log(LOG_INFO, "OCSP: s_poll_wait: TIMEOUTbusy exceeded");
+
+    enter_critical_section(CRIT_OCSP);
+    if(!waiter.woken) /* the entry is still pending */
+        for(ptr=&entry->waiters; *ptr; ptr=&(*ptr)->next)
+            if(*ptr==&waiter) {
+                *ptr=waiter.next;
+                break;
+            }
+    closesocket(waiter.fd[0]);
+    closesocket(waiter.fd[1]);
+    return !waiter.woken;
+}
+
+/* called inside CRIT_OCSP */
+NOEXPORT OCSP_ENTRY *ocsp_cache_find(SERVICE_OPTIONS *section,
+        const unsigned char *id, int id_len) {
+    OCSP_ENTRY *entry;
+
+    for(entry=section->ocsp_cache; entry; entry=entry->next)
+        if(entry->id_len==id_len && !memcmp(entry->id, id, id_len))
+            return entry;
+    return NULL;
+}
+
+/* called inside CRIT_OCSP */
+NOEXPORT OCSP_ENTRY *ocsp_cache_new(SERVICE_OPTIONS *section,
+        OCSP_CERTID *certID, unsigned char *id, int id_len) {
+    OCSP_ENTRY *entry, **ptr, **victim=NULL;
+
+    if(section->ocsp_cached>=OCSP_CACHE_SIZE) {
+        /* evict the idle entry that expires first */
+        for(ptr=&section->ocsp_cache; *ptr; ptr=&(*ptr)->next)
+            if(!(*ptr)->pending && (!victim || (*ptr)->expire<(*victim)->expire))
+                victim=ptr;
+        if(victim) {
+            entry=*victim;
+            *victim=entry->next;
+            --section->ocsp_cached;
+            OCSP_CERTID_free(entry->cert_id);
+            str_free(entry->response);
+            str_free(entry->id);
+            str_free(entry);
+        }
+    }
+    entry=str_alloc(sizeof(OCSP_ENTRY));
+    str_detach(entry);
+    entry->id=str_alloc(id_len);
+    str_detach(entry->id);
+    memcpy(entry->id, id, id_len);
+    entry->id_len=id_len;
+    entry->cert_id=OCSP_CERTID_dup(certID);
+    entry->next=section->ocsp_cache;
+    section->ocsp_cache=entry;
+    ++section->ocsp_cached;
+    return entry;
+}
+
+/* store the result of a query and wake up the waiting handshakes */
+NOEXPORT void ocsp_cache_update(OCSP_ENTRY *entry, OCSP_RESPONSE *response,
+        int status, int reason, time_t this_update, time_t next_update) {
+    unsigned char *der=NULL, *der_tmp;
+    int der_len=0;
+    OCSP_WAITER *waiter;
+    time_t now=time(NULL);
+
+    if(response) {
+        der_len=i2d_OCSP_RESPONSE(response, NULL);
+        if(der_len>0) {
+            der_tmp=der=str_alloc(der_len);
+            str_detach(der);
+            i2d_OCSP_RESPONSE(response, &der_tmp);
+        }
+    }
+    enter_critical_section(CRIT_OCSP);
+    if(der) {
+        str_free(entry->response);
+        entry->response=der;
+        entry->response_len=der_len;
+        entry->status=status;
+        entry->reason=reason;
+        entry->expire=next_update;
+        if(this_update>now)
+            this_update=now;
+        if(entry->staple) /* well before the stapled response expires */
+            entry->refresh=this_update+(next_update-this_update)/2;
+        else /* after 3/4 of the validity period */
+            entry->refresh=this_update+(next_update-this_update)/4*3;
+    } else { /* do not hammer a failing responder */
+        entry->refresh=now+OCSP_CACHE_RETRY;
+    }
+    entry->pending=entry->queued=0;
+    for(waiter=entry->waiters; waiter; waiter=waiter->next) {
+        waiter->woken=1;
+        writesocket(waiter->fd[1], "", 1);
+    }
+    entry->waiters=NULL;
+    leave_critical_section(CRIT_OCSP);
+}
+
+#ifndef USE_FORK
+
+/* start the background refresh thread unless already running */
+NOEXPORT void ocsp_refresh(SERVICE_OPTIONS *section) {
+    CLI *c;
+    OCSP_ENTRY *entry;
+    int running;
+
+    enter_critical_section(CRIT_OCSP);
+    running=section->ocsp_refreshing;
+    section->ocsp_refreshing=1;
+    leave_critical_section(CRIT_OCSP);
+    if(running)
+        return;
+    s_log(LOG_DEBUG, "OCSP: Starting background refresh");
+    c=alloc_client_session(section, -1, -1);
+    if(create_client(-1, -1, c, ocsp_refresh_thread)) {
+        s_log(LOG_ERR, "OCSP: Failed to start background refresh");
+        enter_critical_section(CRIT_OCSP);
+        for(entry=section->ocsp_cache; entry; entry=entry->next)
+            if(entry->queued) /* retry on a later handshake */
+                entry->pending=entry->queued=0;
+        section->ocsp_refreshing=0;
+        leave_critical_section(CRIT_OCSP);
+    }
+}
+
+/* refresh the queued entries, cached responses remain valid meanwhile */
+NOEXPORT void *ocsp_refresh_thread(void *arg) {
+    CLI *c=arg;
+    OCSP_ENTRY *entry;
+    int status, reason;
+
+    c->fd=-1;
+    c->fds=s_poll_alloc();
+    for(;;) {
+        enter_critical_section(CRIT_OCSP);
+#ifdef USE_OCSP_STAPLING
+        entry=c->opt->ocsp_staple;
+        if(!entry || !entry->queued)
+#endif
+        for(entry=c->opt->ocsp_cache; entry; entry=entry->next)
+            if(entry->queued)
+                break;
+        if(entry)
+            entry->queued=0;
+        else
+            c->opt->ocsp_refreshing=0;
+        leave_critical_section(CRIT_OCSP);
+        if(!entry)
+            break;
+        ocsp_fetch(c, entry, &status, &reason);
+    }
+    s_poll_free(c->fds);
+    str_free(c);
+    str_cleanup();
+    /* s_log() is not allowed after str_cleanup() */
+#if defined(USE_WIN32) && !defined(_WIN32_WCE)
+    _endthread();
+#endif
+#if defined(USE_UCONTEXT) || defined(USE_EPOLL)
+    s_poll_wait(NULL, 0, 0); /* wait on poll() */
+#endif
+    return NULL;
+}
+
+#endif /* !USE_FORK */
+
+/* query the responder for a pending entry, returns 1 on success */
+NOEXPORT int ocsp_fetch(CLI *c, OCSP_ENTRY *entry,
+        int *status_ret, int *reason_ret) {
+    int error, retval=0;
+    SOCKADDR_UNION *addr=&c->opt->ocsp_addr;
+    char *path=c->opt->ocsp_path;
+    X509_STORE *store=c->opt->revocation_store;
+    STACK_OF(X509) *certs=NULL;
+    unsigned long flags=c->opt->ocsp_flags;
+    OCSP_CERTID *certID;
+    OCSP_REQUEST *request=NULL;
+    OCSP_RESPONSE *response=NULL;
+    OCSP_BASICRESP *basicResponse=NULL;
+    ASN1_GENERALIZEDTIME *revoked_at=NULL,
+        *this_update=NULL, *next_update=NULL;
+    int status=0, reason=0;
+    time_t now=time(NULL);
 
     /* build request */
     request=OCSP_REQUEST_new();
@@ -454,14 +784,27 @@ NOEXPORT int ocsp_check(X509_STORE_CTX *callback_ctx) {
         sslerror("OCSP: OCSP_REQUEST_new");
         goto cleanup;
     }
-    if(!OCSP_request_add0_id(request, certID)) {
+    certID=OCSP_CERTID_dup(entry->cert_id);
+    if(!certID || !OCSP_request_add0_id(request, certID)) {
         sslerror("OCSP: OCSP_request_add0_id");
+        if(certID)
+            OCSP_CERTID_free(certID);
         goto cleanup;
     }
-    OCSP_request_add1_nonce(request, 0, -1);
+    /* a stapled response is served to many clients, so it has no nonce */
+#ifdef USE_OCSP_STAPLING
+    if(entry->staple) { /* verified against the issuer of our certificate */
+        addr=&c->opt->staple_addr;
+        path=c->opt->staple_path;
+        store=c->opt->staple_store;
+        certs=c->opt->staple_certs;
+        flags=0;
+    } else
+#endif
+        OCSP_request_add1_nonce(request, 0, -1);
 
     /* send the request and get a response */
-    response=ocsp_get_response(c, request);
+    response=ocsp_get_response(c, addr, path, request);
     if(!response)
         goto cleanup;
     error=OCSP_response_status(response);
@@ -478,16 +821,15 @@ NOEXPORT int ocsp_check(X509_STORE_CTX *callback_ctx) {
         sslerror("OCSP: OCSP_response_get1_basic");
         goto cleanup;
     }
-    if(OCSP_check_nonce(request, basicResponse)<=0) {
+    if(!entry->staple && OCSP_check_nonce(request, basicResponse)<=0) {
         sslerror("OCSP: OCSP_check_nonce");
         goto cleanup;
     }
-    if(OCSP_basic_verify(basicResponse, NULL,
-            c->opt->revocation_store, c->opt->ocsp_flags)<=0) {
+    if(OCSP_basic_verify(basicResponse, certs, store, flags)<=0) {
         sslerror("OCSP: OCSP_basic_verify");
         goto cleanup;
     }
-    if(!OCSP_resp_find_status(basicResponse, certID, &status, &reason,
+    if(!OCSP_resp_find_status(basicResponse, entry->cert_id, &status, &reason,
             &revoked_at, &this_update, &next_update)) {
         sslerror("OCSP: OCSP_resp_find_status");
         goto cleanup;
@@ -501,19 +843,23 @@ NOEXPORT int ocsp_check(X509_STORE_CTX *callback_ctx) {
         sslerror("OCSP: OCSP_check_validity");
         goto cleanup;
     }
-    if(status==V_OCSP_CERTSTATUS_REVOKED) {
-        if(reason==-1)
-            s_log(LOG_WARNING, "OCSP: Certificate revoked");
-        else
-            s_log(LOG_WARNING, "OCSP: Certificate revoked: %d: %s",
-                reason, OCSP_crl_reason_str(reason));
+    if(status==V_OCSP_CERTSTATUS_REVOKED)
         log_time(LOG_NOTICE, "OCSP: Revoked at", revoked_at);
-        goto cleanup;
-    }
+    *status_ret=status;
+    *reason_ret=reason;
     retval=1; /* success */
 cleanup:
-    if(issuer)
-        X509_free(issuer);
+    if(retval)
+        ocsp_cache_update(entry, response, status, reason,
+            ocsp_time(this_update, now),
+            next_update ? ocsp_time(next_update, now) :
+                now+OCSP_CACHE_TIMEOUT);
+    else
+        ocsp_cache_update(entry, NULL, 0, 0, 0, 0);
+    if(!retval && entry->staple)
+        s_log(LOG_WARNING,
+            "OCSP stapling: Response not refreshed, retrying in %d seconds",
+            OCSP_CACHE_RETRY);
     if(request)
         OCSP_REQUEST_free(request);
     if(response)
@@ -523,18 +869,25 @@ cleanup:
     return retval;
 }
 
-NOEXPORT OCSP_RESPONSE *ocsp_get_response(CLI *c, OCSP_REQUEST *req) {
+NOEXPORT OCSP_RESPONSE *ocsp_get_response(CLI *c,
+        SOCKADDR_UNION *addr, char *path, OCSP_REQUEST *req) {
     BIO *bio=NULL;
     OCSP_REQ_CTX *req_ctx=NULL;
     OCSP_RESPONSE *resp=NULL;
+    s_poll_set *fds;
     int err;
 
+    /* a private set for s_connect(): the slots of c->fds are kept by */
+    /* transfer() when a renegotiation verifies the peer certificate */
+    fds=c->fds;
+    c->fds=s_poll_alloc();
+
     /* connect specified OCSP server (responder) */
-    c->fd=s_socket(c->opt->ocsp_addr.sa.sa_family, SOCK_STREAM, 0,
+    c->fd=s_socket(addr->sa.sa_family, SOCK_STREAM, 0,
         1, "OCSP: socket (auth_user)");
     if(c->fd<0)
         goto cleanup;
-    if(s_connect(c, &c->opt->ocsp_addr, addr_len(&c->opt->ocsp_addr)))
+    if(s_connect(c, addr, addr_len(addr)))
         goto cleanup;
     bio=BIO_new_fd(c->fd, BIO_NOCLOSE);
     if(!bio)
@@ -542,7 +895,7 @@ NOEXPORT OCSP_RESPONSE *ocsp_get_response(CLI *c, OCSP_REQUEST *req) {
     s_log(LOG_DEBUG, "OCSP: server connected");
 
     /* OCSP protocol communication loop */
-    req_ctx=OCSP_sendreq_new(bio, c->opt->ocsp_path, req, -1);
+    req_ctx=OCSP_sendreq_new(bio, path, req, -1);
     if(!req_ctx) {
         sslerror("OCSP: OCSP_sendreq_new");
         goto cleanup;
@@ -568,6 +921,8 @@ NOEXPORT OCSP_RESPONSE *ocsp_get_response(CLI *c, OCSP_REQUEST *req) {
     }
 
 cleanup:
+    s_poll_free(c->fds); /* unregister before closing */
+    c->fds=fds;
     if(req_ctx)
         OCSP_REQ_CTX_free(req_ctx);
     if(bio)
@@ -579,6 +934,162 @@ cleanup:
     return resp;
 }
 
+#ifdef USE_OCSP_STAPLING
+
+/**************************************** OCSP stapling */
+
+/* the response for the local certificate is fetched and refreshed by the
+ * background refresh context, so handshakes never wait for the responder */
+
+int ocsp_staple_init(SERVICE_OPTIONS *section) {
+    X509 *cert, *issuer;
+    STACK_OF(OPENSSL_STRING) *urls;
+    char *url, *host=NULL, *port=NULL, *path=NULL;
+    int ssl, retval=1;
+    OCSP_ENTRY *entry;
+
+    cert=SSL_CTX_get0_certificate(section->ctx);
+    if(!cert) {
+        s_log(LOG_ERR, "OCSP stapling: No certificate loaded");
+        return 1; /* FAILED */
+    }
+    urls=X509_get1_ocsp(cert);
+    if(!urls || !sk_OPENSSL_STRING_num(urls)) {
+        s_log(LOG_ERR, "OCSP stapling: No OCSP responder in the certificate");
+        goto cleanup;
+    }
+    url=sk_OPENSSL_STRING_value(urls, 0);
+    if(!OCSP_parse_url(url, &host, &port, &path, &ssl)) {
+        sslerror("OCSP stapling: OCSP_parse_url");
+        goto cleanup;
+    }
+    if(ssl) {
+        s_log(LOG_ERR, "OCSP stapling: SSL not supported for OCSP: %s", url);
+        goto cleanup;
+    }
+    if(!hostport2addr(&section->staple_addr, host, port)) {
+        s_log(LOG_ERR, "OCSP stapling: Failed to resolve %s", url);
+        goto cleanup;
+    }
+    section->staple_path=str_dup(path);
+
+    issuer=ocsp_staple_issuer(section, cert);
+    if(!issuer) {
+        s_log(LOG_ERR, "OCSP stapling: Issuer certificate not found in %s",
+            section->cert);
+        goto cleanup;
+    }
+    section->staple_store=X509_STORE_new();
+    section->staple_certs=sk_X509_new_null();
+    if(!section->staple_store || !section->staple_certs ||
+            !X509_STORE_add_cert(section->staple_store, issuer) ||
+            !sk_X509_push(section->staple_certs, issuer)) {
+        sslerror("OCSP stapling: X509_STORE_add_cert");
+        goto cleanup;
+    }
+    /* the issuer is usually an intermediate CA: do not require a root */
+    X509_STORE_set_flags(section->staple_store, X509_V_FLAG_PARTIAL_CHAIN);
+
+    entry=str_alloc(sizeof(OCSP_ENTRY));
+    str_detach(entry);
+    entry->cert_id=OCSP_cert_to_id(NULL, cert, issuer);
+    if(!entry->cert_id) {
+        sslerror("OCSP stapling: OCSP_cert_to_id");
+        str_free(entry);
+        goto cleanup;
+    }
+    entry->staple=1; /* refresh=0: fetched on the first daemon_loop() pass */
+    section->ocsp_staple=entry;
+
+    SSL_CTX_set_tlsext_status_cb(section->ctx, ocsp_staple_cb);
+    SSL_CTX_set_tlsext_status_arg(section->ctx, section);
+    s_log(LOG_INFO, "OCSP stapling: Responder %s", url);
+    retval=0; /* OK */
+cleanup:
+    if(host)
+        OPENSSL_free(host);
+    if(port)
+        OPENSSL_free(port);
+    if(path)
+        OPENSSL_free(path);
+    if(urls)
+        X509_email_free(urls);
+    return retval;
+}
+
+NOEXPORT X509 *ocsp_staple_issuer(SERVICE_OPTIONS *section, X509 *cert) {
+    STACK_OF(X509) *chain=NULL;
+    int i;
+
+    SSL_CTX_get0_chain_certs(section->ctx, &chain);
+    if(!chain || !sk_X509_num(chain)) /* older style extra chain */
+        SSL_CTX_get_extra_chain_certs(section->ctx, &chain);
+    for(i=0; chain && i<sk_X509_num(chain); ++i)
+        if(X509_check_issued(sk_X509_value(chain, i), cert)==X509_V_OK)
+            return sk_X509_value(chain, i);
+    return NULL;
+}
+
+/* queue a due refresh, return seconds to the next check */
+int ocsp_staple_timer(SERVICE_OPTIONS *section) {
+    OCSP_ENTRY *entry=section->ocsp_staple;
+    long left;
+    int refresh=0;
+
+    enter_critical_section(CRIT_OCSP);
+    left=(long)(entry->refresh-time(NULL));
+    if(entry->pending) {
+        left=OCSP_CACHE_RETRY; /* the refresh is still in progress */
+    } else if(left<=0) {
+        entry->pending=entry->queued=1;
+        refresh=1;
+        left=OCSP_CACHE_RETRY;
+    }
+    leave_critical_section(CRIT_OCSP);
+    if(refresh)
+        ocsp_refresh(section);
+    return (int)left;
+}
+
+/* status_request callback: only copies the cached response */
+NOEXPORT int ocsp_staple_cb(SSL *ssl, void *arg) {
+    SERVICE_OPTIONS *section=arg;
+    OCSP_ENTRY *entry=section->ocsp_staple;
+    unsigned char *response=NULL;
+    int len=0;
+
+    enter_critical_section(CRIT_OCSP);
+    if(entry->response && time(NULL)<entry->expire) {
+        len=entry->response_len;
+        response=OPENSSL_malloc(len);
+        if(response)
+            memcpy(response, entry->response, len);
+    }
+    leave_critical_section(CRIT_OCSP);
+    if(!response) {
+        s_log(LOG_INFO, "OCSP stapling: No valid response to staple");
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    SSL_set_tlsext_status_ocsp_resp(ssl, response, len); /* takes ownership */
+    s_log(LOG_DEBUG, "OCSP stapling: Response stapled");
+    return SSL_TLSEXT_ERR_OK;
+}
+
+#endif /* USE_OCSP_STAPLING */
+
+/* convert an ASN.1 time, or return the default if not supported */
+NOEXPORT time_t ocsp_time(ASN1_GENERALIZEDTIME *t, time_t dflt) {
+#if OPENSSL_VERSION_NUMBER>=0x10002000L
+    int days, secs;
+
+    if(t && ASN1_TIME_diff(&days, &secs, NULL, t))
+        return time(NULL)+(time_t)days*86400+secs;
+#else
+    (void)t; /* skip warning about unused parameter */
+#endif
+    return dflt;
+}
+
 #endif /* HAVE_OSSL_OCSP_H */
 
 char *X509_NAME2text(X509_NAME *name) {